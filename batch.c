@@ -0,0 +1,278 @@
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "source.h"
+#include "vm.h"
+
+struct script {
+	char *path;
+	char *out; /* what the script printed */
+	size_t out_length;
+	char *err; /* its error messages */
+	size_t err_length;
+	int status;
+	double ms;
+	bool done;
+};
+
+struct batch;
+
+/* each worker starts with a contiguous run of scripts, [front, back). The
+ * owner takes from the front, so the output of its share comes out in
+ * order; a worker that runs dry steals from the back of the others*/
+struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int front;
+	int back;
+	int id;
+	struct batch *batch;
+};
+
+struct batch {
+	struct script *scripts;
+	int count;
+	struct worker *workers;
+	int worker_count;
+	bool quicken;
+	int max_frames;
+	bool g_format;
+
+	pthread_mutex_t done_lock;
+	pthread_cond_t done_cond; /* signalled as each script finishes */
+};
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int take(struct worker *w)
+{
+	int i = -1;
+	pthread_mutex_lock(&w->lock);
+	if (w->front < w->back)
+		i = w->front++;
+	pthread_mutex_unlock(&w->lock);
+	return i;
+}
+
+static int steal(struct worker *w)
+{
+	struct batch *b = w->batch;
+
+	for (int k = 1; k < b->worker_count; k++) {
+		int id = (w->id + k) % b->worker_count;
+		struct worker *victim = &b->workers[id];
+		int i = -1;
+
+		pthread_mutex_lock(&victim->lock);
+		if (victim->front < victim->back)
+			i = --victim->back;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (i != -1)
+			return i;
+	}
+	return -1;
+}
+
+static void run_script(struct vm *v, struct script *s)
+{
+	FILE *out = open_memstream(&s->out, &s->out_length);
+	FILE *err = open_memstream(&s->err, &s->err_length);
+	if (!out || !err) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+
+	double start = now();
+	v->out.file = out;
+	v->err = err;
+
+	/* a mapped source stays mapped until the next vm_reset*/
+	struct source source;
+	if (load_source(v, s->path, &source)) {
+		s->status = exit_status(vm_interpret(v, source.chars));
+		free_source(&source);
+	} else {
+		fprintf(err, "Couldn't read file \"%s\": %s.\n", s->path,
+			strerror(errno));
+		s->status = 74;
+	}
+
+	flush_output(&v->out);
+	v->out.file = stdout;
+	v->err = stderr;
+	s->ms = (now() - start) * 1000;
+
+	fclose(out);
+	fclose(err);
+}
+
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+	struct batch *b = w->batch;
+	struct vm *v = vm_new();
+	v->quicken = b->quicken;
+	v->max_frames = b->max_frames;
+	v->out.g_format = b->g_format;
+	/* each script's output is gathered whole anyway*/
+	v->out.policy = FLUSH_BLOCK;
+	/* the vm is reset after every script*/
+	v->use_arenas = true;
+	bool used = false;
+
+	for (;;) {
+		int i = take(w);
+		if (i == -1)
+			i = steal(w);
+		/* every script was handed out up front, so none will turn up*/
+		if (i == -1)
+			break;
+
+		if (used)
+			vm_reset(v);
+		used = true;
+		run_script(v, &b->scripts[i]);
+
+		pthread_mutex_lock(&b->done_lock);
+		b->scripts[i].done = true;
+		pthread_cond_broadcast(&b->done_cond);
+		pthread_mutex_unlock(&b->done_lock);
+	}
+
+	vm_free(v);
+	return NULL;
+}
+
+static int is_script(const struct dirent *e)
+{
+	size_t len = strlen(e->d_name);
+	return len > 4 && strcmp(e->d_name + len - 4, ".lox") == 0;
+}
+
+static void add_script(struct batch *b, int *capacity, char *path)
+{
+	if (b->count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 16;
+		b->scripts = realloc(b->scripts,
+				     sizeof(struct script) * *capacity);
+		if (!b->scripts) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(74);
+		}
+	}
+
+	struct script *s = &b->scripts[b->count++];
+	memset(s, 0, sizeof(*s));
+	s->path = path;
+}
+
+/* a directory stands for the .lox files directly in it, by name*/
+static void add_path(struct batch *b, int *capacity, const char *path)
+{
+	struct dirent **entries;
+	int n = scandir(path, &entries, is_script, alphasort);
+
+	if (n < 0) {
+		add_script(b, capacity, strdup(path));
+		return;
+	}
+
+	for (int i = 0; i < n; i++) {
+		size_t len = strlen(path) + strlen(entries[i]->d_name) + 2;
+		char *p = malloc(len);
+		snprintf(p, len, "%s/%s", path, entries[i]->d_name);
+		add_script(b, capacity, p);
+		free(entries[i]);
+	}
+	free(entries);
+}
+
+int run_batch(const char **paths, int count, int jobs)
+{
+	struct batch b = { 0 };
+	int capacity = 0;
+	b.quicken = vm->quicken;
+	b.max_frames = vm->max_frames;
+	b.g_format = vm->out.g_format;
+
+	for (int i = 0; i < count; i++)
+		add_path(&b, &capacity, paths[i]);
+
+	if (jobs > b.count)
+		jobs = b.count;
+	if (jobs < 1)
+		jobs = 1;
+
+	pthread_mutex_init(&b.done_lock, NULL);
+	pthread_cond_init(&b.done_cond, NULL);
+	b.workers = calloc(jobs, sizeof(struct worker));
+	b.worker_count = jobs;
+
+	double start = now();
+
+	for (int i = 0; i < jobs; i++) {
+		struct worker *w = &b.workers[i];
+		pthread_mutex_init(&w->lock, NULL);
+		w->front = (int)((long)b.count * i / jobs);
+		w->back = (int)((long)b.count * (i + 1) / jobs);
+		w->id = i;
+		w->batch = &b;
+	}
+	for (int i = 0; i < jobs; i++)
+		pthread_create(&b.workers[i].thread, NULL, work, &b.workers[i]);
+
+	int status = 0;
+	int failed = 0;
+
+	for (int i = 0; i < b.count; i++) {
+		struct script *s = &b.scripts[i];
+
+		pthread_mutex_lock(&b.done_lock);
+		while (!s->done)
+			pthread_cond_wait(&b.done_cond, &b.done_lock);
+		pthread_mutex_unlock(&b.done_lock);
+
+		fwrite(s->out, 1, s->out_length, stdout);
+		fflush(stdout);
+		fwrite(s->err, 1, s->err_length, stderr);
+		fprintf(stderr, "%s: exit %d, %.3f ms\n", s->path, s->status,
+			s->ms);
+
+		if (s->status) {
+			failed++;
+			if (!status)
+				status = s->status;
+		}
+
+		free(s->out);
+		free(s->err);
+		free(s->path);
+	}
+
+	/* others may still look into a worker's share after it is done*/
+	for (int i = 0; i < jobs; i++)
+		pthread_join(b.workers[i].thread, NULL);
+	for (int i = 0; i < jobs; i++)
+		pthread_mutex_destroy(&b.workers[i].lock);
+
+	fprintf(stderr, "batch: %d scripts, %d failed, %.3f ms on %d threads\n",
+		b.count, failed, (now() - start) * 1000, jobs);
+
+	pthread_mutex_destroy(&b.done_lock);
+	pthread_cond_destroy(&b.done_cond);
+	free(b.workers);
+	free(b.scripts);
+	return status;
+}
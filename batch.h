@@ -0,0 +1,11 @@
+#ifndef CLOX_BATCH_H
+#define CLOX_BATCH_H
+
+/* run every script named in paths, a directory standing for the .lox files
+ * in it, on jobs worker threads with a vm each. Every script's output is
+ * captured and written out in order, followed by its exit status and run
+ * time on stderr. Returns the exit status of the first script that failed,
+ * or 0*/
+int run_batch(const char **paths, int count, int jobs);
+
+#endif
@@ -0,0 +1,58 @@
+/* per-call cost of the embedding API: compile a script once, then call one
+ * of its functions from C over and over. Build with make bench/embed*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../vm.h"
+
+static const char *src = "fun add(a, b) { return a + b; }\n"
+			 "fun greet(name) { return \"hello \" + name; }\n";
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	int calls = argc > 1 ? atoi(argv[1]) : 1000000;
+	struct vm *v = vm_new();
+
+	obj_function_t *script = vm_compile(v, src);
+	if (!script || vm_run(v, script) != INTERPRET_OK)
+		return 70;
+
+	int add = vm_global_slot(v, "add");
+	int greet = vm_global_slot(v, "greet");
+	double sum = 0;
+	value_t result;
+
+	double start = now();
+	for (int i = 0; i < calls; i++) {
+		vm_push_global(v, add);
+		vm_push(v, NUMBER(i));
+		vm_push(v, NUMBER(1));
+		if (vm_call(v, 2, &result) != INTERPRET_OK)
+			return 70;
+		sum += AS_NUMBER(result);
+	}
+	double elapsed = now() - start;
+	printf("add:   %d calls, %.1f ns per call (sum %.0f)\n", calls,
+	       elapsed / calls * 1e9, sum);
+
+	start = now();
+	for (int i = 0; i < calls; i++) {
+		vm_push_global(v, greet);
+		vm_push_string(v, "world", 5);
+		if (vm_call(v, 1, &result) != INTERPRET_OK)
+			return 70;
+	}
+	elapsed = now() - start;
+	printf("greet: %d calls, %.1f ns per call (%s)\n", calls,
+	       elapsed / calls * 1e9, AS_CSTRING(result));
+
+	vm_free(v);
+	return 0;
+}
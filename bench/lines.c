@@ -0,0 +1,77 @@
+/* line lookups: fill a chunk with a few million bytes of code spread over
+ * many lines, then time get_line_number at random offsets against walking
+ * the table from the start as runtime errors used to. Build with
+ * make bench/lines and run as
+ *
+ *	bench/lines [bytes] [bytes per line] [lookups]*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../chunk.h"
+#include "../vm.h"
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int walk(struct chunk *c, int offset)
+{
+	int i = 0;
+	while (i + 1 < c->line_count && c->lines[i + 1].offset <= offset)
+		i++;
+	return c->lines[i].line;
+}
+
+int main(int argc, char *argv[])
+{
+	int bytes = argc > 1 ? atoi(argv[1]) : 4000000;
+	int per_line = argc > 2 ? atoi(argv[2]) : 8;
+	int lookups = argc > 3 ? atoi(argv[3]) : 1000000;
+	if (bytes < 1 || per_line < 1 || lookups < 1) {
+		fprintf(stderr, "Usage: lines [bytes] [bytes per line] "
+				"[lookups]\n");
+		return 64;
+	}
+
+	vm = vm_new();
+	struct chunk c;
+	init_chunk(&c);
+	for (int i = 0; i < bytes; i++)
+		write_chunk(&c, OP_NIL, 1 + i / per_line);
+
+	int *offsets = malloc(sizeof(int) * lookups);
+	srand(1);
+	for (int i = 0; i < lookups; i++)
+		offsets[i] = (int)((double)rand() / RAND_MAX * (bytes - 1));
+
+	long sum = 0;
+	double start = now();
+	for (int i = 0; i < lookups; i++)
+		sum += get_line_number(&c, offsets[i]);
+	double search = now() - start;
+
+	/* the walk is linear in the offset, so it gets far fewer tries*/
+	int walks = lookups / 1000 > 0 ? lookups / 1000 : 1;
+	long check = 0;
+	start = now();
+	for (int i = 0; i < walks; i++)
+		check += walk(&c, offsets[i]);
+	double walked = now() - start;
+
+	for (int i = 0; i < walks; i++)
+		check -= get_line_number(&c, offsets[i]);
+
+	printf("%d bytes on %d lines, %zu bytes of line table\n", c.count,
+	       c.line_count, sizeof(struct line_start) * c.line_count);
+	printf("binary search %10.1f ns/lookup\n", search / lookups * 1e9);
+	printf("linear walk   %10.1f ns/lookup%s\n", walked / walks * 1e9,
+	       check ? "  (mismatch)" : "");
+
+	free(offsets);
+	free_chunk(&c);
+	vm_free(vm);
+	return sum == 0;
+}
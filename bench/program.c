@@ -0,0 +1,118 @@
+/* a big program: generate a script of many small functions and a loop that
+ * calls every one of them, then report what compiling it took and how fast
+ * the loop runs once all that code is live. Build with make bench/program
+ * and run as
+ *
+ *	bench/program [functions] [runs]
+ *
+ * Build with CFLAGS+=-DNO_CODE_ARENA to compare against chunks that keep
+ * arrays of their own*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../vm.h"
+
+/* functions called from each function the loop calls. Jumps only reach so
+ * far, so the loop can't call them all itself*/
+#define GROUP 500
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* resident set in bytes*/
+static long resident()
+{
+	long pages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f) {
+		if (fscanf(f, "%*d %ld", &pages) != 1)
+			pages = 0;
+		fclose(f);
+	}
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+static char *generate(int functions)
+{
+	char *src;
+	size_t length;
+	FILE *f = open_memstream(&src, &length);
+	if (!f) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+
+	for (int i = 0; i < functions; i++) {
+		fprintf(f, "fun f%d(a) {\n", i);
+		fprintf(f, "\tvar x = a * %d + %d.5;\n", i % 7 + 2, i);
+		fprintf(f, "\tif (x > %d) x = x - %d; else x = x + 1;\n",
+			i + 100, i % 13 + 1);
+		fprintf(f, "\twhile (x > %d) x = x / 2;\n", i % 50 + 10);
+		fprintf(f, "\tif (x == %d) print \"f%d\";\n", -i - 1, i);
+		fprintf(f, "\treturn x + %d;\n}\n", i % 11);
+	}
+
+	int groups = (functions + GROUP - 1) / GROUP;
+	for (int g = 0; g < groups; g++) {
+		fprintf(f, "fun g%d(i) {\n\tvar t = 0;\n", g);
+		for (int i = g * GROUP; i < functions && i < (g + 1) * GROUP; i++)
+			fprintf(f, "\tt = t + f%d(i);\n", i);
+		fprintf(f, "\treturn t;\n}\n");
+	}
+
+	fprintf(f, "fun run(n) {\n\tvar t = 0;\n");
+	fprintf(f, "\tfor (var i = 0; i < n; i = i + 1) {\n");
+	for (int g = 0; g < groups; g++)
+		fprintf(f, "\t\tt = t + g%d(i);\n", g);
+	fprintf(f, "\t}\n\treturn t;\n}\n");
+
+	fclose(f);
+	return src;
+}
+
+int main(int argc, char *argv[])
+{
+	int functions = argc > 1 ? atoi(argv[1]) : 5000;
+	int runs = argc > 2 ? atoi(argv[2]) : 200;
+	if (functions < 1 || runs < 1) {
+		fprintf(stderr, "Usage: program [functions] [runs]\n");
+		return 64;
+	}
+
+	char *src = generate(functions);
+	struct vm *v = vm_new();
+	v->use_arenas = true;
+
+	long before = resident();
+	double start = now();
+	obj_function_t *script = vm_compile(v, src);
+	if (!script || vm_run(v, script) != INTERPRET_OK)
+		return 70;
+	double compiled = now() - start;
+	long grown = resident() - before;
+
+	value_t result;
+	vm_push_global(v, vm_global_slot(v, "run"));
+	vm_push(v, NUMBER(runs));
+	start = now();
+	if (vm_call(v, 1, &result) != INTERPRET_OK)
+		return 70;
+	double ran = now() - start;
+
+	printf("%d functions, %.1f ms to compile, %ld KB more resident\n",
+	       functions, compiled * 1e3, grown / 1024);
+	printf("heap %zu KB, code arena %zu KB, data arena %zu KB\n",
+	       v->bytes_allocated / 1024, v->code_arena.bytes / 1024,
+	       v->data_arena.bytes / 1024);
+	printf("%.1f ns per call (total %g)\n",
+	       ran / ((double)functions * runs) * 1e9, AS_NUMBER(result));
+
+	vm_free(v);
+	free(src);
+	return 0;
+}
@@ -0,0 +1,75 @@
+/* scanner throughput: tokenize a script over and over and report MB/s.
+ * Build with make bench/scan and run as
+ *
+ *	bench/scan script.lox [runs]
+ *
+ * Build with CFLAGS+=-DNO_SIMD_SCANNER to compare against the byte at a
+ * time loops*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../scanner.h"
+
+static char *read_file(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Couldn't open file \"%s\".\n", path);
+		exit(74);
+	}
+
+	fseek(file, 0L, SEEK_END);
+	*size = ftell(file);
+	rewind(file);
+
+	char *buf = malloc(*size + 1);
+	if (!buf || fread(buf, 1, *size, file) < *size) {
+		fprintf(stderr, "Couldn't read file \"%s\".\n", path);
+		exit(74);
+	}
+	buf[*size] = '\0';
+
+	fclose(file);
+	return buf;
+}
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: scan script.lox [runs]\n");
+		return 64;
+	}
+
+	size_t size;
+	char *src = read_file(argv[1], &size);
+	int runs = argc > 2 ? atoi(argv[2]) : 100;
+	long tokens = 0;
+	int lines = 0;
+
+	double start = now();
+	for (int i = 0; i < runs; i++) {
+		struct token t;
+		init_scanner(src);
+		do {
+			t = scan_token();
+			tokens++;
+		} while (t.type != TOKEN_EOF);
+		lines = t.line;
+	}
+	double secs = now() - start;
+
+	printf("%zu bytes, %d lines, %ld tokens a run\n", size, lines,
+	       tokens / runs);
+	printf("%.1f MB/s, %.1f Mtokens/s\n", size * (double)runs / secs / 1e6,
+	       tokens / secs / 1e6);
+
+	free(src);
+	return 0;
+}
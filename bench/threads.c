@@ -0,0 +1,122 @@
+/* thread scaling: every thread runs the same script in a vm of its own, so
+ * throughput should grow with the thread count until the cores run out.
+ * Build with make bench/threads and run as
+ *
+ *	bench/threads script.lox [max threads] [runs per thread] > /dev/null
+ *
+ * The scripts print to stdout, the results go to stderr*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../vm.h"
+
+struct worker {
+	pthread_t thread;
+	const char *src;
+	int runs;
+	bool failed;
+};
+
+static char *read_file(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Couldn't open file \"%s\".\n", path);
+		exit(74);
+	}
+
+	fseek(file, 0L, SEEK_END);
+	size_t size = ftell(file);
+	rewind(file);
+
+	char *buf = malloc(size + 1);
+	if (!buf || fread(buf, 1, size, file) < size) {
+		fprintf(stderr, "Couldn't read file \"%s\".\n", path);
+		exit(74);
+	}
+	buf[size] = '\0';
+
+	fclose(file);
+	return buf;
+}
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void *run(void *arg)
+{
+	struct worker *w = arg;
+	struct vm *v = vm_new();
+
+	for (int i = 0; i < w->runs; i++) {
+		if (vm_interpret(v, w->src) != INTERPRET_OK)
+			w->failed = true;
+	}
+
+	vm_free(v);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: threads script.lox [max threads] "
+				"[runs per thread]\n");
+		return 64;
+	}
+
+	char *src = read_file(argv[1]);
+	int max_threads = argc > 2 ? atoi(argv[2]) :
+				     (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int runs = argc > 3 ? atoi(argv[3]) : 10;
+	if (max_threads < 1 || runs < 1) {
+		fprintf(stderr, "Thread and run counts must be positive.\n");
+		return 64;
+	}
+
+	struct worker *workers = calloc(max_threads, sizeof(struct worker));
+	double base = 0;
+
+	fprintf(stderr, "%8s %12s %9s %11s\n", "threads", "runs/s", "speedup",
+		"efficiency");
+
+	/* 1, 2, 4, ... threads, ending on max_threads*/
+	for (int n = 1;; n = n * 2 < max_threads ? n * 2 : max_threads) {
+		double start = now();
+
+		for (int i = 0; i < n; i++) {
+			workers[i].src = src;
+			workers[i].runs = runs;
+			workers[i].failed = false;
+			pthread_create(&workers[i].thread, NULL, run,
+				       &workers[i]);
+		}
+
+		bool failed = false;
+		for (int i = 0; i < n; i++) {
+			pthread_join(workers[i].thread, NULL);
+			failed |= workers[i].failed;
+		}
+
+		double rate = n * runs / (now() - start);
+		if (n == 1)
+			base = rate;
+
+		fprintf(stderr, "%8d %12.1f %8.2fx %10.0f%%%s\n", n, rate,
+			rate / base, 100 * rate / base / n,
+			failed ? "  (errors)" : "");
+
+		if (n == max_threads)
+			break;
+	}
+
+	free(workers);
+	free(src);
+	return 0;
+}
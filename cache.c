@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "vm.h"
+
+/*
+ * Layout. All integers are native-endian uint32 unless noted, and every
+ * variable-length run is padded to 4 bytes so that line tables can be used
+ * in place.
+ *
+ *   header    "LOXC", version, byte order mark, source hash (uint64),
+ *             global count
+ *   globals   one string per global slot the code was compiled against
+ *   function  arity, name, code count, line table length, code bytes,
+ *             line table as (offset, line) pairs, constant count,
+ *             constants
+ *
+ * A string is its length followed by its bytes; UINT32_MAX stands for "no
+ * string". A constant is a tag followed by its payload, nested functions
+ * are written recursively.
+ */
+
+#define CACHE_MAGIC "LOXC"
+#define CACHE_BYTE_ORDER 0x01020304u
+#define NO_STRING UINT32_MAX
+
+typedef enum {
+	CONST_NUMBER,
+	CONST_NIL,
+	CONST_TRUE,
+	CONST_FALSE,
+	CONST_STRING,
+	CONST_FUNCTION,
+} constant_tag_t;
+
+struct writer {
+	FILE *file;
+	size_t pos;
+	bool ok;
+};
+
+struct reader {
+	uint8_t *base;
+	uint8_t *p;
+	uint8_t *end;
+	bool ok;
+};
+
+uint64_t hash_source(const char *src, size_t length)
+{
+	/* 64 bit FNV-1a*/
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)src[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static void write_bytes(struct writer *w, const void *p, size_t n)
+{
+	if (n && fwrite(p, 1, n, w->file) != n)
+		w->ok = false;
+	w->pos += n;
+}
+
+static void write_u32(struct writer *w, uint32_t v)
+{
+	write_bytes(w, &v, sizeof(v));
+}
+
+static void write_align(struct writer *w)
+{
+	static const uint8_t zeros[4];
+	write_bytes(w, zeros, (4 - w->pos % 4) % 4);
+}
+
+static void write_string(struct writer *w, obj_string_t *s)
+{
+	if (!s) {
+		write_u32(w, NO_STRING);
+		return;
+	}
+	write_u32(w, s->length);
+	write_bytes(w, s->chars, s->length);
+	write_align(w);
+}
+
+static void write_function(struct writer *w, obj_function_t *f)
+{
+	struct chunk *c = &f->chunk;
+	int line_count = c->line_count;
+
+	write_u32(w, f->arity);
+	write_string(w, f->name);
+	write_u32(w, c->count);
+	write_u32(w, line_count);
+	write_bytes(w, c->code, c->count);
+	write_align(w);
+	write_bytes(w, c->lines, sizeof(struct line_start) * line_count);
+
+	write_u32(w, c->constants.count);
+	for (int i = 0; i < c->constants.count; i++) {
+		value_t v = c->constants.values[i];
+
+		if (IS_NUMBER(v)) {
+			double d = AS_NUMBER(v);
+			write_u32(w, CONST_NUMBER);
+			write_bytes(w, &d, sizeof(d));
+		} else if (IS_NIL(v)) {
+			write_u32(w, CONST_NIL);
+		} else if (IS_BOOL(v)) {
+			write_u32(w, AS_BOOL(v) ? CONST_TRUE : CONST_FALSE);
+		} else if (IS_STRING(v)) {
+			write_u32(w, CONST_STRING);
+			write_string(w, AS_STRING(v));
+		} else if (IS_FUNCTION(v)) {
+			write_u32(w, CONST_FUNCTION);
+			write_function(w, AS_FUNCTION(v));
+		} else {
+			/* the compiler emits no other constants*/
+			w->ok = false;
+		}
+	}
+}
+
+bool write_cache(obj_function_t *script, const char *path,
+		 uint64_t source_hash)
+{
+	struct writer w;
+	w.file = fopen(path, "wb");
+	w.pos = 0;
+	w.ok = w.file != NULL;
+	if (!w.ok)
+		return false;
+
+	write_bytes(&w, CACHE_MAGIC, 4);
+	write_u32(&w, CACHE_FORMAT_VERSION);
+	write_u32(&w, CACHE_BYTE_ORDER);
+	write_bytes(&w, &source_hash, sizeof(source_hash));
+
+	/* the code refers to globals by slot; record which name each slot
+	 * held so the loader can map them onto its own vm*/
+	write_u32(&w, vm->global_count);
+	for (int i = 0; i < vm->global_count; i++)
+		write_string(&w, vm->globals[i].name);
+
+	write_function(&w, script);
+
+	if (fclose(w.file) != 0)
+		w.ok = false;
+	if (!w.ok)
+		remove(path);
+	return w.ok;
+}
+
+static void *read_bytes(struct reader *r, size_t n)
+{
+	if (!r->ok || (size_t)(r->end - r->p) < n) {
+		r->ok = false;
+		return NULL;
+	}
+	void *p = r->p;
+	r->p += n;
+	return p;
+}
+
+static uint32_t read_u32(struct reader *r)
+{
+	uint32_t v = 0;
+	void *p = read_bytes(r, sizeof(v));
+	if (p)
+		memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void read_align(struct reader *r)
+{
+	read_bytes(r, (4 - (r->p - r->base) % 4) % 4);
+}
+
+static obj_string_t *read_string(struct reader *r)
+{
+	uint32_t length = read_u32(r);
+	if (length == NO_STRING)
+		return NULL;
+
+	char *chars = read_bytes(r, length);
+	read_align(r);
+	if (!r->ok)
+		return NULL;
+	return copy_string(chars, length);
+}
+
+/* rewrite global operands whose slot differs in this vm, and check every
+ * constant and local operand stays within the chunk's constants and the
+ * function's frame. The mapping is private, so only the pages touched here
+ * get copied*/
+static bool relocate_code(struct chunk *c, int *slots, int slot_count,
+			  int max_stack)
+{
+	int constant_count = c->constants.count;
+
+	for (int offset = 0; offset < c->count;
+	     offset += instruction_size(c->code[offset])) {
+		uint8_t *operand = &c->code[offset + 1];
+		uint8_t op = c->code[offset];
+		int size = instruction_size(op);
+
+		if (offset + size > c->count)
+			return false;
+
+		switch (op) {
+		case OP_DEFINE_GLOBAL:
+		case OP_GET_GLOBAL:
+		case OP_SET_GLOBAL:
+		case OP_SET_GLOBAL_POP: {
+			if (operand[0] >= slot_count)
+				return false;
+			int slot = slots[operand[0]];
+			if (slot > UINT8_MAX)
+				return false;
+			if (slot != operand[0])
+				operand[0] = slot;
+			break;
+		}
+		case OP_DEFINE_GLOBAL_LONG:
+		case OP_GET_GLOBAL_LONG:
+		case OP_SET_GLOBAL_LONG: {
+			int old = operand[0] << 16 | operand[1] << 8 |
+				  operand[2];
+			if (old >= slot_count)
+				return false;
+			int slot = slots[old];
+			if (slot != old) {
+				operand[0] = (slot >> 16) & 0xff;
+				operand[1] = (slot >> 8) & 0xff;
+				operand[2] = slot & 0xff;
+			}
+			break;
+		}
+		case OP_CONSTANT:
+			if (operand[0] >= constant_count)
+				return false;
+			break;
+		case OP_CONSTANT_LONG:
+			if ((operand[0] << 16 | operand[1] << 8 | operand[2]) >=
+			    constant_count)
+				return false;
+			break;
+		case OP_GET_LOCAL:
+		case OP_SET_LOCAL:
+		case OP_SET_LOCAL_POP:
+			if (operand[0] >= max_stack)
+				return false;
+			break;
+		case OP_ADD_LOCALS:
+			if (operand[0] >= max_stack || operand[1] >= max_stack)
+				return false;
+			break;
+		case OP_ADD_LOCAL_CONST:
+		case OP_SUB_LOCAL_CONST:
+		case OP_LESS_LOCAL_CONST_JUMP:
+			if (operand[0] >= max_stack ||
+			    operand[1] >= constant_count)
+				return false;
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+/* get_line_number counts on the first entry starting the code and the
+ * offsets going up from there*/
+static bool lines_valid(struct line_start *lines, uint32_t line_count,
+			uint32_t count)
+{
+	if (line_count == 0 || line_count > count || lines[0].offset != 0)
+		return false;
+	for (uint32_t i = 1; i < line_count; i++) {
+		if (lines[i].offset <= lines[i - 1].offset ||
+		    (uint32_t)lines[i].offset >= count)
+			return false;
+	}
+	return true;
+}
+
+static obj_function_t *read_function(struct reader *r, int *slots,
+				     int slot_count)
+{
+	obj_function_t *f = new_function();
+	push(OBJ(f)); /* reachable while its constants are allocated*/
+
+	f->arity = read_u32(r);
+	if (f->arity < 0 || f->arity > UINT8_MAX)
+		r->ok = false;
+	f->name = read_string(r);
+
+	uint32_t count = read_u32(r);
+	uint32_t line_count = read_u32(r);
+	uint8_t *code = read_bytes(r, count);
+	read_align(r);
+	struct line_start *lines =
+		read_bytes(r, sizeof(struct line_start) * (size_t)line_count);
+
+	if (!r->ok || !lines_valid(lines, line_count, count)) {
+		r->ok = false;
+		pop();
+		return NULL;
+	}
+
+	struct chunk *c = &f->chunk;
+	c->borrowed = true;
+	c->code = code;
+	c->count = count;
+	c->capacity = count;
+	c->lines = lines;
+	c->line_count = line_count;
+	c->line_capacity = line_count;
+
+	uint32_t constant_count = read_u32(r);
+	for (uint32_t i = 0; r->ok && i < constant_count; i++) {
+		value_t v = NIL_VAL;
+
+		switch (read_u32(r)) {
+		case CONST_NUMBER: {
+			double d = 0;
+			void *p = read_bytes(r, sizeof(d));
+			if (p)
+				memcpy(&d, p, sizeof(d));
+			/* any other NaN could carry the bits of a boxed nil,
+			 * bool or object pointer*/
+			if (d != d)
+				d = NAN;
+			v = NUMBER(d);
+			break;
+		}
+		case CONST_NIL:
+			break;
+		case CONST_TRUE:
+			v = BOOL(true);
+			break;
+		case CONST_FALSE:
+			v = BOOL(false);
+			break;
+		case CONST_STRING: {
+			obj_string_t *s = read_string(r);
+			if (!s)
+				r->ok = false;
+			v = OBJ(s);
+			break;
+		}
+		case CONST_FUNCTION: {
+			obj_function_t *nested =
+				read_function(r, slots, slot_count);
+			v = OBJ(nested);
+			break;
+		}
+		default:
+			r->ok = false;
+			break;
+		}
+
+		if (r->ok)
+			add_constant(c, v);
+	}
+
+	/* operands are checked against the constants, so once they are in*/
+	int depth = r->ok ? max_stack_depth(c) : -1;
+	if (depth == -1)
+		r->ok = false;
+	f->max_stack = 1 + f->arity + depth;
+	if (r->ok && !relocate_code(c, slots, slot_count, f->max_stack))
+		r->ok = false;
+
+#ifdef CODE_ARENA
+	/* the code stays in the mapping*/
+	if (r->ok && vm->use_arenas)
+		finalize_chunk(c);
+#endif
+
+	pop();
+	return r->ok ? f : NULL;
+}
+
+obj_function_t *load_cache(const char *path, uint64_t source_hash)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < 24) {
+		close(fd);
+		return NULL;
+	}
+
+	/* private and writable: relocation and quickening may patch code,
+	 * the file itself is never modified*/
+	void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	struct reader r;
+	r.base = base;
+	r.p = base;
+	r.end = r.base + st.st_size;
+	r.ok = true;
+
+	uint64_t hash;
+	char *magic = read_bytes(&r, 4);
+	uint32_t version = read_u32(&r);
+	uint32_t byte_order = read_u32(&r);
+	memcpy(&hash, read_bytes(&r, sizeof(hash)), sizeof(hash));
+
+	if (memcmp(magic, CACHE_MAGIC, 4) != 0 ||
+	    version != CACHE_FORMAT_VERSION ||
+	    byte_order != CACHE_BYTE_ORDER ||
+	    (source_hash && hash != source_hash)) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	uint32_t slot_count = read_u32(&r);
+	if (slot_count > (size_t)(r.end - r.p) / sizeof(uint32_t)) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	int *slots = malloc(sizeof(int) * (slot_count + 1));
+	for (uint32_t i = 0; r.ok && i < slot_count; i++) {
+		obj_string_t *name = read_string(&r);
+		if (name)
+			slots[i] = global_slot(name);
+		else
+			r.ok = false;
+	}
+
+	obj_function_t *script = NULL;
+	if (r.ok)
+		script = read_function(&r, slots, slot_count);
+	free(slots);
+
+	if (!script) {
+		/* any functions read so far are unreachable; their chunks
+		 * are borrowed, so the gc never touches the unmapped code*/
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	add_mapping(vm, base, st.st_size);
+	return script;
+}
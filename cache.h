@@ -0,0 +1,25 @@
+#ifndef CLOX_CACHE_H
+#define CLOX_CACHE_H
+
+#include "common.h"
+#include "object.h"
+#include "source.h"
+
+/*
+ * On-disk bytecode cache. A .loxc file holds a compiled script: the global
+ * names its code refers to and the tree of functions with their code, line
+ * tables and constants. Loading maps the file and runs code and line tables
+ * in place; only strings are copied (and interned) and functions allocated.
+ */
+
+/* bump whenever the bytecode or the file layout changes*/
+#define CACHE_FORMAT_VERSION 7
+
+uint64_t hash_source(const char *src, size_t length);
+bool write_cache(obj_function_t *script, const char *path,
+		 uint64_t source_hash);
+/* returns NULL if the file is missing, corrupt, from another format version
+ * or, unless source_hash is 0, compiled from a different source*/
+obj_function_t *load_cache(const char *path, uint64_t source_hash);
+
+#endif
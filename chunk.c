@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include "chunk.h"
 #include "memory.h"
+#include "vm.h"
 
 void init_chunk(struct chunk *c)
 {
@@ -9,16 +10,21 @@ void init_chunk(struct chunk *c)
 	c->capacity = 0;
 	c->code = NULL;
 	c->lines = NULL;
-	c->curr_line = 0;
-	c->lines_capacity = 0;
+	c->line_count = 0;
+	c->line_capacity = 0;
+	c->borrowed = false;
+	c->finalized = false;
 	init_value_array(&c->constants);
 }
 
 void free_chunk(struct chunk *c)
 {
-	FREE_ARRAY(uint8_t, c->code, c->capacity);
-	FREE_ARRAY(int, c->lines, c->lines_capacity);
-	free_value_array(&c->constants);
+	if (!c->borrowed) {
+		FREE_ARRAY(uint8_t, c->code, c->capacity);
+		FREE_ARRAY(struct line_start, c->lines, c->line_capacity);
+	}
+	if (!c->finalized)
+		free_value_array(&c->constants);
 	init_chunk(c);
 }
 
@@ -30,69 +36,301 @@ void write_chunk(struct chunk *c, uint8_t byte, int line)
 		c->code = GROW_ARRAY(c->code, uint8_t, old, c->capacity);
 	}
 
-	if (c->curr_line + 2 >= c->lines_capacity) {
-		int old = c->lines_capacity;
-		c->lines_capacity = GROW_CAPACITY(old);
-		c->lines = GROW_ARRAY(c->lines, int, old, c->lines_capacity);
-		ZERO_INITIALIZE(c->lines + old, int, old, c->lines_capacity);
+	if (c->line_count == 0 || c->lines[c->line_count - 1].line != line) {
+		if (c->line_count + 1 > c->line_capacity) {
+			int old = c->line_capacity;
+			c->line_capacity = GROW_CAPACITY(old);
+			c->lines = GROW_ARRAY(c->lines, struct line_start, old,
+					      c->line_capacity);
+		}
+		c->lines[c->line_count++] =
+			(struct line_start){ c->count, line };
 	}
 
 	c->code[c->count] = byte;
 	c->count++;
+}
 
-	if (line == c->lines[c->curr_line]) {
-		c->lines[c->curr_line + 1]++;
+void finalize_chunk(struct chunk *c)
+{
+	if (!c->borrowed) {
+		uint8_t *code = arena_alloc(&vm->code_arena, c->count, 1);
+		memcpy(code, c->code, c->count);
+		struct line_start *lines = arena_alloc(
+			&vm->data_arena, sizeof(struct line_start) * c->line_count,
+			_Alignof(struct line_start));
+		memcpy(lines, c->lines, sizeof(struct line_start) * c->line_count);
 
-	} else {
-		c->curr_line += 2;
-		c->lines[c->curr_line] = line;
-		c->lines[c->curr_line + 1]++;
+		FREE_ARRAY(uint8_t, c->code, c->capacity);
+		FREE_ARRAY(struct line_start, c->lines, c->line_capacity);
+		c->code = code;
+		c->capacity = c->count;
+		c->lines = lines;
+		c->line_capacity = c->line_count;
+		c->borrowed = true;
 	}
+
+	struct value_array *k = &c->constants;
+	int count = k->count;
+	value_t *values = arena_alloc(&vm->data_arena, sizeof(value_t) * count,
+				      _Alignof(value_t));
+	if (count)
+		memcpy(values, k->values, sizeof(value_t) * count);
+	free_value_array(k);
+	k->values = values;
+	k->count = count;
+	k->capacity = count;
+	c->finalized = true;
 }
 
-void undo_last_write_to_chunk(struct chunk *c)
+void truncate_chunk(struct chunk *c, int count)
 {
-	if (c->count > 0) {
-		c->count--;
+	if (count >= c->count)
+		return;
+	c->count = count;
+	while (c->line_count > 0 && c->lines[c->line_count - 1].offset >= count)
+		c->line_count--;
+}
+
+void cut_chunk(struct chunk *c, int start, uint8_t *code, int *lines)
+{
+	int run = c->line_count - 1;
+
+	for (int offset = c->count - 1; offset >= start; offset--) {
+		while (c->lines[run].offset > offset)
+			run--;
+		code[offset - start] = c->code[offset];
+		lines[offset - start] = c->lines[run].line;
 	}
+	truncate_chunk(c, start);
 }
 
 int add_constant(struct chunk *c, value_t val)
 {
+	/* keep val reachable in case growing the pool triggers a collection*/
+	push(val);
 	write_value_array(&c->constants, val);
+	pop();
 	return c->constants.count - 1;
 }
 
-/* Write more constant to the constant pool
- *  The maximum number of constants is 2^24
+/* Indices up to 255 keep the short, one byte operand form so small chunks pay
+ *  nothing. The maximum index is 2^24 - 1
  */
-int write_constant(struct chunk *c, value_t val, int line)
+void write_indexed(struct chunk *c, uint8_t op, uint8_t long_op, int index,
+		   int line)
 {
-	write_chunk(c, OP_CONSTANT_LONG, line);
-	int const_idx = add_constant(c, val);
-	/* write the index of the constant as a 24 bit integer*/
-	uint8_t idx1 = (const_idx >> 16) & 0xff;
-	uint8_t idx2 = (const_idx >> 8) & 0xff;
-	uint8_t idx3 = const_idx & 0xff;
-
-	write_chunk(c, idx1, line);
-	write_chunk(c, idx2, line);
-	write_chunk(c, idx3, line);
-
-	return const_idx;
+	if (index <= UINT8_MAX) {
+		write_chunk(c, op, line);
+		write_chunk(c, index, line);
+		return;
+	}
+
+	write_chunk(c, long_op, line);
+	/* write the index as a 24 bit integer*/
+	write_chunk(c, (index >> 16) & 0xff, line);
+	write_chunk(c, (index >> 8) & 0xff, line);
+	write_chunk(c, index & 0xff, line);
 }
 
 int get_line_number(struct chunk *c, int offset)
 {
-	if (!c || !c->lines)
+	if (!c || c->line_count == 0)
 		return -1;
 
-	int i = 0;
-	int tally = c->lines[1];
+	/* the last start at or before offset. The first is always at 0*/
+	int lo = 0;
+	int hi = c->line_count - 1;
+	while (lo < hi) {
+		int mid = lo + (hi - lo + 1) / 2;
+		if (c->lines[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return c->lines[lo].line;
+}
 
-	while (offset + 1 > tally) {
-		i += 2;
-		tally += c->lines[i - 1];
+int instruction_size(uint8_t op)
+{
+	switch (op) {
+	case OP_CONSTANT:
+	case OP_DEFINE_GLOBAL:
+	case OP_GET_GLOBAL:
+	case OP_SET_GLOBAL:
+	case OP_GET_LOCAL:
+	case OP_SET_LOCAL:
+	case OP_CALL:
+	case OP_TAIL_CALL:
+	case OP_SET_LOCAL_POP:
+	case OP_SET_GLOBAL_POP:
+		return 2;
+	case OP_ADD_LOCALS:
+	case OP_ADD_LOCAL_CONST:
+	case OP_SUB_LOCAL_CONST:
+		return 3;
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP:
+	case OP_LOOP:
+	case OP_JUMP_IF_FALSE_POP:
+	case OP_LESS_JUMP:
+		return 3;
+	case OP_CONSTANT_LONG:
+	case OP_DEFINE_GLOBAL_LONG:
+	case OP_GET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_LONG:
+		return 4;
+	case OP_LESS_LOCAL_CONST_JUMP:
+		return 5;
+	default:
+		return 1;
+	}
+}
+
+/* change in stack height after op runs, or INT_MIN for an unknown opcode*/
+static int stack_effect(uint8_t op, uint8_t operand)
+{
+	switch (op) {
+	case OP_CONSTANT:
+	case OP_CONSTANT_LONG:
+	case OP_NIL:
+	case OP_FALSE:
+	case OP_TRUE:
+	case OP_GET_GLOBAL:
+	case OP_GET_GLOBAL_LONG:
+	case OP_GET_LOCAL:
+	case OP_ADD_LOCALS:
+	case OP_ADD_LOCAL_CONST:
+	case OP_SUB_LOCAL_CONST:
+		return 1;
+	case OP_NEGATE:
+	case OP_NOT:
+	case OP_SET_GLOBAL:
+	case OP_SET_GLOBAL_LONG:
+	case OP_SET_LOCAL:
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP:
+	case OP_LOOP:
+	case OP_LESS_LOCAL_CONST_JUMP:
+		return 0;
+	case OP_RETURN:
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULT:
+	case OP_DIV:
+	case OP_EQUAL:
+	case OP_GREATER:
+	case OP_LESS:
+	case OP_NOT_EQUAL:
+	case OP_GREATER_EQUAL:
+	case OP_LESS_EQUAL:
+	case OP_ADD_NUM:
+	case OP_ADD_STR:
+	case OP_PRINT:
+	case OP_POP:
+	case OP_POPX:
+	case OP_DEFINE_GLOBAL:
+	case OP_DEFINE_GLOBAL_LONG:
+	case OP_JUMP_IF_FALSE_POP:
+	case OP_SET_LOCAL_POP:
+	case OP_SET_GLOBAL_POP:
+		return -1;
+	case OP_LESS_JUMP:
+		return -2;
+	case OP_CALL:
+	case OP_TAIL_CALL:
+		/* the callee and its arguments become the result*/
+		return -operand;
+	default:
+		return INT_MIN;
 	}
-	return c->lines[i - 2];
-}
\ No newline at end of file
+}
+
+static bool is_jump(uint8_t op)
+{
+	return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP ||
+	       op == OP_JUMP_IF_FALSE_POP || op == OP_LESS_JUMP ||
+	       op == OP_LESS_LOCAL_CONST_JUMP;
+}
+
+int max_stack_depth(struct chunk *c)
+{
+	/* height on entry to each instruction, -1 until a path reaches it.
+	 * The compiler keeps the stack balanced, so every path into an
+	 * instruction must agree on its height. Offsets inside an instruction
+	 * get -2, which no path agrees with: a jump there would run operand
+	 * bytes as code that nothing decoding from the start has checked*/
+	int *heights = ALLOCATE(int, c->count);
+	int *pending = ALLOCATE(int, c->count); /* paths left to follow*/
+	int pending_count = 0;
+	int max = 0;
+
+	for (int i = 0; i < c->count; i++)
+		heights[i] = -2;
+	for (int i = 0; i < c->count; i += instruction_size(c->code[i]))
+		heights[i] = -1;
+	if (c->count > 0) {
+		heights[0] = 0;
+		pending[pending_count++] = 0;
+	}
+
+	while (pending_count > 0 && max != -1) {
+		int offset = pending[--pending_count];
+
+		while (offset != -1) {
+			uint8_t op = c->code[offset];
+			int next = offset + instruction_size(op);
+			if (next > c->count) {
+				max = -1;
+				break;
+			}
+
+			uint8_t operand = next > offset + 1 ? c->code[offset + 1] : 0;
+			int effect = stack_effect(op, operand);
+			int height = heights[offset] + effect;
+			if (effect == INT_MIN || height < 0) {
+				max = -1;
+				break;
+			}
+			if (height > max)
+				max = height;
+
+			int to = -1;
+			if (is_jump(op)) {
+				int jmp = c->code[next - 2] << 8 |
+					  c->code[next - 1];
+				to = op == OP_LOOP ? next - jmp : next + jmp;
+			}
+			/* the rest of the path is unreachable*/
+			if (op == OP_RETURN || op == OP_JUMP || op == OP_LOOP)
+				next = -1;
+
+			offset = -1;
+			for (int k = 0; k < 2; k++) {
+				int target = k ? next : to;
+				if (target == -1)
+					continue;
+				if (target < 0 || target >= c->count ||
+				    (heights[target] != -1 &&
+				     heights[target] != height)) {
+					max = -1;
+					break;
+				}
+				if (heights[target] != -1)
+					continue;
+
+				heights[target] = height;
+				if (k)
+					offset = target;
+				else
+					pending[pending_count++] = target;
+			}
+			if (max == -1)
+				break;
+		}
+	}
+
+	FREE_ARRAY(int, heights, c->count);
+	FREE_ARRAY(int, pending, c->count);
+	return max;
+}
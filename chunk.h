@@ -32,28 +32,75 @@ typedef enum {
 	OP_JUMP,
 	OP_LOOP,
 	OP_CALL,
+	OP_DEFINE_GLOBAL_LONG,
+	OP_GET_GLOBAL_LONG,
+	OP_SET_GLOBAL_LONG,
+	/* emitted by the peephole optimizer*/
+	OP_NOT_EQUAL,
+	OP_GREATER_EQUAL,
+	OP_LESS_EQUAL,
+	OP_JUMP_IF_FALSE_POP,
+	OP_LESS_JUMP,
+	/* superinstructions, also from the optimizer*/
+	OP_ADD_LOCALS,
+	OP_ADD_LOCAL_CONST,
+	OP_SUB_LOCAL_CONST,
+	OP_LESS_LOCAL_CONST_JUMP, /* jumps unless local < constant*/
+	OP_SET_LOCAL_POP,
+	OP_SET_GLOBAL_POP,
+	OP_TAIL_CALL, /* a call whose result is returned right away*/
+	/* quickened forms, patched in at runtime by their generic op*/
+	OP_ADD_NUM,
+	OP_ADD_STR,
 
 } op_code;
 
+/* the code from offset on, up to the next entry's offset, is from line*/
+struct line_start {
+	int offset;
+	int line;
+};
+
 struct chunk {
 	int count;
 	int capacity;
 	uint8_t *code; /* bytes of instructions*/
 
 	struct value_array constants; /* constant data pool*/
-	int *lines; /*line number to report errors*/
-	int curr_line; /* the line_no of the current instruction*/
-	int lines_capacity; /* capacity of the lines array */
+	/* where each line's code starts, by offset. Kept apart from the code
+	 * and only read to report errors, so it may be searched instead*/
+	struct line_start *lines;
+	int line_count;
+	int line_capacity;
+	bool borrowed; /* code and lines live in memory the chunk doesn't own,
+			  e.g. a mapped bytecode cache or the code arena*/
+	bool finalized; /* complete, its constants in the vm's data arena */
 };
 
 void init_chunk(struct chunk *c);
 void free_chunk(struct chunk *c);
 void write_chunk(struct chunk *c, uint8_t byte, int line);
-void undo_last_write_to_chunk(struct chunk *c);
+/* move a complete chunk into the vm's arenas, trimmed to size: owned code
+ * goes to the code arena, constants and owned lines to the data arena. No
+ * more may be written to it, though its code may still be patched*/
+void finalize_chunk(struct chunk *c);
+/* drop every instruction from offset count on, line info included*/
+void truncate_chunk(struct chunk *c, int count);
+/* move the code from offset start on out of the chunk, along with the line
+ * of each byte*/
+void cut_chunk(struct chunk *c, int start, uint8_t *code, int *lines);
 /* returns the index where val was added*/
 int add_constant(struct chunk *c, value_t val);
-int write_constant(struct chunk *c, value_t val, int line);
-/*given the offset of an instruction, return it's line number*/
+/* write op with a constant or global index operand, switching to long_op and
+ * a 24 bit operand when the index doesn't fit in a byte*/
+void write_indexed(struct chunk *c, uint8_t op, uint8_t long_op, int index,
+		   int line);
+/* the line the byte at offset came from, found by binary search*/
 int get_line_number(struct chunk *c, int offset);
+/* size in bytes of an instruction, opcode included*/
+int instruction_size(uint8_t op);
+/* the most values the code keeps on the stack at once, or -1 if it isn't
+ * well formed, a jump into the middle of an instruction included*/
+int max_stack_depth(struct chunk *c);
 
 #endif
@@ -8,8 +8,61 @@
 #include <malloc.h>
 #include <limits.h>
 
+/* release builds (-DNDEBUG) drop the tracing and disassembly output*/
+#ifndef NDEBUG
 #define DEBUG_TRACE_EXECUTION
 #define DEBUG_PRINT_CODE
+#endif
+
+/* dispatch instructions through a table of label addresses when the compiler
+ * supports labels-as-values. Define NO_COMPUTED_GOTO to use the portable
+ * switch instead*/
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+/* pack values into 8-byte NaN-boxed words. Define NO_NAN_BOXING to get the
+ * 16-byte tagged union instead, which is easier to inspect in a debugger*/
+#ifndef NO_NAN_BOXING
+#define NAN_BOXING
+#endif
+
+/* run the peephole optimizer over every compiled chunk. Define NO_PEEPHOLE
+ * to see the code exactly as the compiler emits it*/
+#ifndef NO_PEEPHOLE
+#define PEEPHOLE
+#endif
+
+/* let generic arithmetic and comparison instructions rewrite themselves into
+ * type-specialized forms as they run. Define NO_QUICKEN to leave the code as
+ * compiled; --no-quicken turns it off at runtime*/
+#ifndef NO_QUICKEN
+#define QUICKEN
+#endif
+
+/* copy each chunk, once compiled, into arenas shared by the whole program:
+ * code in one, constants and line tables in another, if the vm's
+ * use_arenas is set. Define NO_CODE_ARENA to leave every chunk in arrays of
+ * its own*/
+#ifndef NO_CODE_ARENA
+#define CODE_ARENA
+#endif
+
+/* serve objects and short buffers from per-vm pools of fixed-size slots
+ * instead of malloc. Define NO_POOL_ALLOC to malloc everything*/
+#ifndef NO_POOL_ALLOC
+#define POOL_ALLOC
+#endif
+
+/* skip whitespace and comments and find the end of strings and identifiers
+ * 16 bytes at a time with SSE2. The loads are aligned so they never cross
+ * into a page past the terminating NUL, but they do read a few bytes past
+ * it, which AddressSanitizer rightly reports. Define NO_SIMD_SCANNER for the
+ * byte at a time loops*/
+#if defined(__SSE2__) && !defined(__SANITIZE_ADDRESS__) && \
+	!defined(NO_SIMD_SCANNER)
+#define SIMD_SCANNER
+#endif
 
 #define MAX_CONST_INDEX 16777216
 #define UINT8_COUNT UINT8_MAX + 1
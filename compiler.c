@@ -4,6 +4,10 @@
 #include "scanner.h"
 #include "compiler.h"
 #include "value.h"
+#include "memory.h"
+#include "vm.h"
+#include "optimizer.h"
+#include "source.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -14,10 +18,11 @@ struct parser {
 	struct token current;
 	bool had_error;
 	bool panic_mode;
+	bool borrow_strings; /* the source is mapped for as long as the vm */
 };
 
-struct parser parser;
-struct chunk *compiling_chunk;
+/* each thread compiles on its own*/
+_Thread_local struct parser parser;
 
 typedef enum {
 	PREC_NONE,
@@ -61,9 +66,22 @@ struct compiler {
 	struct local locals[UINT8_COUNT];
 	int local_count;
 	int scope_depth;
+
+	/* open-addressed index of the chunk's constants by value identity, so
+	 * repeated literals share one pool entry. -1 marks an empty slot*/
+	int *constant_slots;
+	int constant_slots_count;
+	int constant_slots_capacity;
+
+	/* where the left operand of the infix operator being compiled begins,
+	 * in the code and in the constant pool*/
+	int operand_start;
+	int operand_constants;
+
+	int last_call; /* offset of the latest OP_CALL, or -1*/
 };
 
-struct compiler *current = NULL;
+_Thread_local struct compiler *current = NULL;
 
 static void expression();
 static void statement();
@@ -110,15 +128,16 @@ static void error_at(struct token *t, const char *msg)
 
 	parser.panic_mode = true;
 
-	fprintf(stderr, "[line %d], Error ", t->line);
+	flush_output(&vm->out);
+	fprintf(vm->err, "[line %d], Error ", t->line);
 	if (t->type == TOKEN_EOF) {
-		fprintf(stderr, " at end");
+		fprintf(vm->err, " at end");
 	} else if (t->type == TOKEN_ERROR) {
 	} else {
-		fprintf(stderr, " at '%.*s'", t->length, t->start);
+		fprintf(vm->err, " at '%.*s'", t->length, t->start);
 	}
 
-	fprintf(stderr, " : %s\n", msg);
+	fprintf(vm->err, " : %s\n", msg);
 	parser.had_error = true;
 }
 
@@ -132,40 +151,159 @@ static void error(const char *msg)
 	error_at(&parser.previous, msg);
 }
 
-static int make_constant(value_t val)
+static void emit_indexed(uint8_t op, uint8_t long_op, int index)
 {
-	int c = add_constant(current_chunk(), val);
+	write_indexed(current_chunk(), op, long_op, index, parser.previous.line);
+}
+
+/* return the slot in the constant index that holds val, or the empty slot
+ * where it belongs. Slots pointing past the end of the pool were left behind
+ * by discarded code and are reused like tombstones*/
+static int *find_constant_slot(int *slots, int capacity, value_t val)
+{
+	value_t *constants = current_chunk()->constants.values;
+	int count = current_chunk()->constants.count;
+	uint32_t mask = capacity - 1;
+	uint32_t i = hash_value(val) & mask;
+	int *tombstone = NULL;
 
-#if 0
-	if (c > UINT8_MAX) {
-		/* undo the last byte written : OP_CONSTANT*/
-		undo_last_write_to_chunk(current_chunk());
-		/* remove the constant*/
-		undo_previous_write(&(current_chunk()->constants));
-		/*re-write as a long constant*/
-		c = write_constant(current_chunk(), val, parser.previous.line);
-
-		if (c > MAX_CONST_INDEX) {
-			error("Too many constants in one chunk.");
+	for (;;) {
+		int *slot = &slots[i];
+		if (*slot == -1)
+			return tombstone ? tombstone : slot;
+		if (*slot >= count) {
+			if (!tombstone)
+				tombstone = slot;
+		} else if (values_identical(constants[*slot], val)) {
+			return slot;
 		}
-	} else {
-		
-		emit_byte(c);
-		
+		i = (i + 1) & mask;
 	}
-#endif
+}
+
+static void cache_constant(int index)
+{
+	value_t *constants = current_chunk()->constants.values;
+	int count = current_chunk()->constants.count;
+
+	if (2 * (current->constant_slots_count + 1) >
+	    current->constant_slots_capacity) {
+		int capacity = GROW_CAPACITY(current->constant_slots_capacity);
+		int *slots = ALLOCATE(int, capacity);
+		for (int i = 0; i < capacity; i++)
+			slots[i] = -1;
+
+		/* rehash*/
+		for (int i = 0; i < current->constant_slots_capacity; i++) {
+			int c = current->constant_slots[i];
+			if (c != -1 && c < count)
+				*find_constant_slot(slots, capacity,
+						    constants[c]) = c;
+		}
 
-	if (c > UINT8_MAX) {
+		FREE_ARRAY(int, current->constant_slots,
+			   current->constant_slots_capacity);
+		current->constant_slots = slots;
+		current->constant_slots_capacity = capacity;
+	}
+
+	*find_constant_slot(current->constant_slots,
+			    current->constant_slots_capacity,
+			    constants[index]) = index;
+	current->constant_slots_count++;
+}
+
+static int make_constant(value_t val)
+{
+	/* every function object is distinct, there is nothing to share*/
+	bool shareable = !IS_FUNCTION(val);
+
+	if (shareable && current->constant_slots_count > 0) {
+		int c = *find_constant_slot(current->constant_slots,
+					    current->constant_slots_capacity,
+					    val);
+		if (c != -1 && c < current_chunk()->constants.count)
+			return c;
+	}
+
+	int c = add_constant(current_chunk(), val);
+
+	if (c >= MAX_CONST_INDEX) {
 		error("Too many constants in one chunk");
+		return 0;
 	}
+
+	/* val is in the pool now, so growing the index can't lose it to a
+	 * collection*/
+	if (shareable)
+		cache_constant(c);
 	return c;
 }
 
 static void emit_constant(value_t val)
 {
-	emit_byte(OP_CONSTANT);
-	emit_byte(make_constant(val)); /* second byte emitted from
-					  make_constant*/
+	/* add val to the pool before emitting anything: until then it is not
+	 * reachable, and growing the code array can trigger a collection*/
+	int c = make_constant(val);
+	emit_indexed(OP_CONSTANT, OP_CONSTANT_LONG, c);
+}
+
+/* load a constant value, using the dedicated opcodes where there are some*/
+static void emit_value(value_t val)
+{
+	if (IS_NIL(val))
+		emit_byte(OP_NIL);
+	else if (IS_BOOL(val))
+		emit_byte(AS_BOOL(val) ? OP_TRUE : OP_FALSE);
+	else
+		emit_constant(val);
+}
+
+/* if the code in [start, end) is exactly one constant load, store the value
+ * it loads in val*/
+static bool constant_between(int start, int end, value_t *val)
+{
+	struct chunk *c = current_chunk();
+
+	if (start >= end || start + instruction_size(c->code[start]) != end)
+		return false;
+
+	uint8_t *operand = &c->code[start + 1];
+
+	switch (c->code[start]) {
+	case OP_CONSTANT:
+		*val = c->constants.values[operand[0]];
+		return true;
+	case OP_CONSTANT_LONG:
+		*val = c->constants.values[operand[0] << 16 | operand[1] << 8 |
+					   operand[2]];
+		return true;
+	case OP_NIL:
+		*val = NIL_VAL;
+		return true;
+	case OP_TRUE:
+		*val = BOOL(true);
+		return true;
+	case OP_FALSE:
+		*val = BOOL(false);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* throw away the code from offset start on, along with the constants added
+ * since the pool held constant_count entries. Only that code can refer to
+ * them*/
+static void discard_code(int start, int constant_count)
+{
+	struct chunk *c = current_chunk();
+
+	truncate_chunk(c, start);
+	if (current->last_call >= start)
+		current->last_call = -1;
+	while (c->constants.count > constant_count)
+		undo_previous_write(&c->constants);
 }
 
 static void emit_loop(int loopstart)
@@ -209,6 +347,10 @@ static void init_compiler(struct compiler *compiler, function_type_t type)
 	compiler->scope_depth = 0;
 	compiler->function = new_function();
 	compiler->local_count = 0;
+	compiler->constant_slots = NULL;
+	compiler->constant_slots_count = 0;
+	compiler->constant_slots_capacity = 0;
+	compiler->last_call = -1;
 	current = compiler;
 
 	/* claim stack slot 0 for vm's internal use*/
@@ -227,6 +369,17 @@ static obj_function_t *end_compiler()
 	emit_return();
 	obj_function_t *func = current->function;
 
+#ifdef PEEPHOLE
+	if (!parser.had_error)
+		optimize_chunk(current_chunk());
+#endif
+
+	if (!parser.had_error) {
+		int depth = max_stack_depth(current_chunk());
+		assert(depth != -1);
+		func->max_stack = 1 + func->arity + depth;
+	}
+
 #ifdef DEBUG_PRINT_CODE
 	if (!parser.had_error) {
 		disassemble_chunk(current_chunk(), func->name != NULL ?
@@ -235,6 +388,14 @@ static obj_function_t *end_compiler()
 	}
 #endif
 
+#ifdef CODE_ARENA
+	if (!parser.had_error && vm->use_arenas)
+		finalize_chunk(current_chunk());
+#endif
+
+	FREE_ARRAY(int, current->constant_slots,
+		   current->constant_slots_capacity);
+
 	/* restore the surrounding function's compiler*/
 	current = current->enclosing;
 	return func;
@@ -276,12 +437,86 @@ static bool match(token_type_t type)
 	return true;
 }
 
+/* evaluate a binary operator on constant operands. Fails for operand types
+ * the operator rejects, leaving the error to the runtime*/
+static bool fold_binary(token_type_t op, value_t a, value_t b, value_t *result)
+{
+	if (op == TOKEN_EQUAL_EQUAL || op == TOKEN_BANG_EQUAL) {
+		*result = BOOL(values_equal(a, b) == (op == TOKEN_EQUAL_EQUAL));
+		return true;
+	}
+
+	if (op == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+		obj_string_t *x = AS_STRING(a);
+		obj_string_t *y = AS_STRING(b);
+		int length = x->length + y->length;
+		char *chars = ALLOCATE(char, length + 1);
+
+		memcpy(chars, x->chars, x->length);
+		memcpy(chars + x->length, y->chars, y->length);
+		chars[length] = '\0';
+		*result = OBJ(take_string(chars, length));
+		return true;
+	}
+
+	if (!IS_NUMBER(a) || !IS_NUMBER(b))
+		return false;
+
+	double x = AS_NUMBER(a);
+	double y = AS_NUMBER(b);
+
+	/* >= and <= are computed as the vm does, which matters for NaN*/
+	switch (op) {
+	case TOKEN_PLUS:
+		*result = NUMBER(x + y);
+		break;
+	case TOKEN_MINUS:
+		*result = NUMBER(x - y);
+		break;
+	case TOKEN_STAR:
+		*result = NUMBER(x * y);
+		break;
+	case TOKEN_SLASH:
+		*result = NUMBER(x / y);
+		break;
+	case TOKEN_GREATER:
+		*result = BOOL(x > y);
+		break;
+	case TOKEN_GREATER_EQUAL:
+		*result = BOOL(!(x < y));
+		break;
+	case TOKEN_LESS:
+		*result = BOOL(x < y);
+		break;
+	case TOKEN_LESS_EQUAL:
+		*result = BOOL(!(x > y));
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
 static void binary(bool can_assign)
 {
+	int left_start = current->operand_start;
+	int left_constants = current->operand_constants;
 	token_type_t op = parser.previous.type;
 	struct parse_rule *rule = get_rule(op);
+	int right_start = current_chunk()->count;
 	parse_precedence(rule->precedence + 1);
 
+	value_t a, b, result;
+	if (constant_between(left_start, right_start, &a) &&
+	    constant_between(right_start, current_chunk()->count, &b) &&
+	    fold_binary(op, a, b, &result)) {
+		/* result is a fresh string at worst, and discarding allocates
+		 * nothing before it is added back to the pool*/
+		discard_code(left_start, left_constants);
+		emit_value(result);
+		return;
+	}
+
 	switch (op) {
 	case TOKEN_PLUS:
 		emit_byte(OP_ADD);
@@ -345,12 +580,37 @@ static void expression_statement()
 	emit_byte(OP_POPX);
 }
 
+/* compile a statement, keeping its code only if it can run. Dead code is
+ * still compiled so that it gets checked for errors*/
+static void branch(bool live)
+{
+	int start = current_chunk()->count;
+	int constants = current_chunk()->constants.count;
+
+	statement();
+	if (!live)
+		discard_code(start, constants);
+}
+
 static void if_statement()
 {
+	int cond_start = current_chunk()->count;
+	int cond_constants = current_chunk()->constants.count;
+
 	consume(TOKEN_LEFT_PAREN, "Expected '(' after 'if'.");
 	expression();
 	consume(TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
 
+	value_t cond;
+	if (constant_between(cond_start, current_chunk()->count, &cond)) {
+		/* only one of the branches can ever run*/
+		discard_code(cond_start, cond_constants);
+		branch(!is_falsy(cond));
+		if (match(TOKEN_ELSE))
+			branch(is_falsy(cond));
+		return;
+	}
+
 	int then_jmp = emit_jump(OP_JUMP_IF_FALSE);
 	emit_byte(OP_POP); /* pop condition off stack - start of then branch*/
 	statement();
@@ -368,11 +628,25 @@ static void while_statement()
 {
 	/* right before the condition */
 	int loopstart = current_chunk()->count;
+	int loop_constants = current_chunk()->constants.count;
 
 	consume(TOKEN_LEFT_PAREN, "Expected '(' after 'while'.");
 	expression();
 	consume(TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
 
+	value_t cond;
+	if (constant_between(loopstart, current_chunk()->count, &cond)) {
+		discard_code(loopstart, loop_constants);
+		if (is_falsy(cond)) {
+			branch(false);
+		} else {
+			/* no exit test; only a return leaves the loop*/
+			statement();
+			emit_loop(loopstart);
+		}
+		return;
+	}
+
 	int exitjump = emit_jump(OP_JUMP_IF_FALSE);
 	emit_byte(OP_POP); /* path 1*/
 	statement();
@@ -397,21 +671,34 @@ static void for_statement()
 	}
 
 	int loopstart = current_chunk()->count;
+	int loop_constants = current_chunk()->constants.count;
 
 	int exitjump = -1;
+	bool dead = false;
 
 	if (!match(TOKEN_SEMICOLON)) {
 		expression();
 		consume(TOKEN_SEMICOLON, "Expected ';'.");
 
-		/* jump out of loop if false*/
-		exitjump = emit_jump(OP_JUMP_IF_FALSE);
-		emit_byte(OP_POP); /* pop the condition*/
+		value_t cond;
+		if (constant_between(loopstart, current_chunk()->count,
+				     &cond)) {
+			/* a true condition is as good as none, a false one
+			 * means the loop never runs*/
+			discard_code(loopstart, loop_constants);
+			dead = is_falsy(cond);
+		} else {
+			/* jump out of loop if false*/
+			exitjump = emit_jump(OP_JUMP_IF_FALSE);
+			emit_byte(OP_POP); /* pop the condition*/
+		}
 	}
 
-	if (!match(TOKEN_RIGHT_PAREN)) { /* there's an increment clause*/
+	uint8_t *increment = NULL;
+	int *increment_lines = NULL;
+	int increment_count = 0;
 
-		int bodyjump = emit_jump(OP_JUMP);
+	if (!match(TOKEN_RIGHT_PAREN)) { /* there's an increment clause*/
 		int increment_start = current_chunk()->count;
 
 		expression();
@@ -419,15 +706,27 @@ static void for_statement()
 
 		consume(TOKEN_RIGHT_PAREN, "Expected ')' after 'for' clause.");
 
-		emit_loop(loopstart);
-
-		loopstart = increment_start;
-
-		back_patch_jump(bodyjump);
+		/* the increment runs after the body. Set its code aside and
+		 * append it once the body is compiled, rather than jumping over
+		 * it and back on every iteration. Its jumps are relative, so
+		 * the code can move*/
+		increment_count = current_chunk()->count - increment_start;
+		increment = ALLOCATE(uint8_t, increment_count);
+		increment_lines = ALLOCATE(int, increment_count);
+		cut_chunk(current_chunk(), increment_start, increment,
+			  increment_lines);
+		/* a call in the increment no longer ends the code*/
+		if (current->last_call >= increment_start)
+			current->last_call = -1;
 	}
 
 	statement();
 
+	for (int i = 0; i < increment_count; i++)
+		write_chunk(current_chunk(), increment[i], increment_lines[i]);
+	FREE_ARRAY(uint8_t, increment, increment_count);
+	FREE_ARRAY(int, increment_lines, increment_count);
+
 	emit_loop(loopstart);
 
 	if (exitjump != -1) {
@@ -435,6 +734,10 @@ static void for_statement()
 		emit_byte(OP_POP); /* pop condition */
 	}
 
+	/* keep the initializer, it runs either way*/
+	if (dead)
+		discard_code(loopstart, loop_constants);
+
 	end_scope();
 }
 
@@ -472,11 +775,16 @@ static void synchronize()
 	}
 }
 
-/* todo: address case of 24-bit constant indices*/
-static uint8_t identifier_constant(struct token *name)
+/* resolve a global name to its slot in vm->globals. The slot is created
+ * undefined if the name hasn't been seen, so functions can refer to globals
+ * declared after them*/
+static int identifier_global(struct token *name)
 {
-	return make_constant(
-		OBJ(copy_string((char *)name->start, name->length)));
+	int slot = global_slot(copy_string((char *)name->start, name->length));
+
+	if (slot >= MAX_CONST_INDEX)
+		error("Too many global variables");
+	return slot;
 }
 
 static bool identifiers_equal(struct token *a, struct token *b)
@@ -534,14 +842,13 @@ static void declare_variable()
 	add_local(*name);
 }
 
-/* todo: address case of 24-bit constant indices*/
-static uint8_t parse_variable(const char *errmsg)
+static int parse_variable(const char *errmsg)
 {
 	consume(TOKEN_IDENTIFIER, errmsg);
 	declare_variable();
 	if (current->scope_depth > 0)
 		return 0;
-	return identifier_constant(&parser.previous);
+	return identifier_global(&parser.previous);
 }
 
 static void mark_initialized()
@@ -553,8 +860,7 @@ static void mark_initialized()
 	current->locals[current->local_count - 1].depth = current->scope_depth;
 }
 
-/* todo: address case of 24-bit constant indices*/
-static void define_variable(uint8_t global)
+static void define_variable(int global)
 {
 	/*local variables are not created at runtime*/
 	/*they land right on top of the stack, where we want them*/
@@ -563,7 +869,7 @@ static void define_variable(uint8_t global)
 		return;
 	}
 
-	emit_2_bytes(OP_DEFINE_GLOBAL, global);
+	emit_indexed(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
 }
 
 static void function(function_type_t type)
@@ -582,7 +888,7 @@ static void function(function_type_t type)
 				error_at_current(
 					"Cannot have more than 255 parameters.");
 
-			uint8_t param_const =
+			int param_const =
 				parse_variable("Expected parameter name.");
 			define_variable(param_const);
 
@@ -597,12 +903,12 @@ static void function(function_type_t type)
 
 	/* create function object*/
 	obj_function_t *func = end_compiler();
-	emit_2_bytes(OP_CONSTANT, make_constant(OBJ(func)));
+	emit_constant(OBJ(func));
 }
 
 static void fun_declaration()
 {
-	uint8_t global = parse_variable("Expected function name.");
+	int global = parse_variable("Expected function name.");
 	/* unlike local variables, a function can refer to itself
 	in its own declaration. So, it can be safely marked as initialized
 	as soon as the name is parsed.*/
@@ -635,7 +941,7 @@ static void or__(bool can_assign)
 
 static void var_declaration()
 {
-	uint8_t global = parse_variable("Expected variable name");
+	int global = parse_variable("Expected variable name");
 
 	if (match(TOKEN_EQUAL)) {
 		expression();
@@ -671,6 +977,13 @@ static void return_statement()
 	} else {
 		expression();
 		consume(TOKEN_SEMICOLON, "Expected ';' after return value.");
+
+		/* the value is a call's result: let the callee take over this
+		 * frame. OP_RETURN stays for callees that can't, like natives,
+		 * and for jumps that land past the call*/
+		int call_at = current_chunk()->count - 2;
+		if (call_at >= 0 && call_at == current->last_call)
+			current_chunk()->code[call_at] = OP_TAIL_CALL;
 		emit_byte(OP_RETURN);
 	}
 }
@@ -701,9 +1014,25 @@ static void statement()
 static void unary(bool can_assign)
 {
 	token_type_t op = parser.previous.type;
+	int start = current_chunk()->count;
+	int constants = current_chunk()->constants.count;
 
 	parse_precedence(PREC_UNARY);
 
+	value_t val;
+	if (constant_between(start, current_chunk()->count, &val)) {
+		if (op == TOKEN_BANG) {
+			discard_code(start, constants);
+			emit_value(BOOL(is_falsy(val)));
+			return;
+		}
+		if (op == TOKEN_MINUS && IS_NUMBER(val)) {
+			discard_code(start, constants);
+			emit_value(NUMBER(-AS_NUMBER(val)));
+			return;
+		}
+	}
+
 	switch (op) {
 	case TOKEN_MINUS:
 		emit_byte(OP_NEGATE);
@@ -744,30 +1073,34 @@ static void string(bool can_assign)
 	char *s = (char *)(parser.previous.start + 1); /* advance past the "
 							  mark*/
 	int l = parser.previous.length - 2;
-	emit_constant(OBJ(copy_string(s, l)));
+	emit_constant(OBJ(parser.borrow_strings ? borrow_string(s, l) :
+						  copy_string(s, l)));
 }
 
 static void named_variable(struct token name, bool can_assign)
 {
-	uint8_t get_op;
-	uint8_t set_op;
+	uint8_t get_op, get_long_op;
+	uint8_t set_op, set_long_op;
 
 	int arg = resolve_local(current, &name);
 
 	if (arg != -1) {
-		get_op = OP_GET_LOCAL;
-		set_op = OP_SET_LOCAL;
+		/* local slots always fit in a byte*/
+		get_op = get_long_op = OP_GET_LOCAL;
+		set_op = set_long_op = OP_SET_LOCAL;
 	} else {
-		arg = identifier_constant(&name);
+		arg = identifier_global(&name);
 		get_op = OP_GET_GLOBAL;
+		get_long_op = OP_GET_GLOBAL_LONG;
 		set_op = OP_SET_GLOBAL;
+		set_long_op = OP_SET_GLOBAL_LONG;
 	}
 
 	if (can_assign && match(TOKEN_EQUAL)) {
 		expression();
-		emit_2_bytes(set_op, (uint8_t)arg);
+		emit_indexed(set_op, set_long_op, arg);
 	} else {
-		emit_2_bytes(get_op, (uint8_t)arg);
+		emit_indexed(get_op, get_long_op, arg);
 	}
 }
 
@@ -798,6 +1131,7 @@ static uint8_t argument_list()
 static void call(bool can_assign)
 {
 	uint8_t argc = argument_list();
+	current->last_call = current_chunk()->count;
 	emit_2_bytes(OP_CALL, argc);
 }
 
@@ -877,12 +1211,17 @@ static void parse_precedence(precedence_t prec)
 	}
 
 	bool can_assign = prec <= PREC_ASSIGNMENT;
+	int start = current_chunk()->count;
+	int constants = current_chunk()->constants.count;
 
 	prefix_rule(can_assign);
 
 	while (prec <= get_rule(parser.current.type)->precedence) {
 		advance();
 		parse_fn infix_rule = get_rule(parser.previous.type)->infix;
+		/* everything compiled since start is the left operand*/
+		current->operand_start = start;
+		current->operand_constants = constants;
 		infix_rule(can_assign);
 	}
 
@@ -894,6 +1233,7 @@ obj_function_t *compile(const char *src)
 {
 	parser.had_error = false;
 	parser.panic_mode = false;
+	parser.borrow_strings = is_mapped(src);
 
 	init_scanner(src);
 
@@ -909,3 +1249,12 @@ obj_function_t *compile(const char *src)
 	obj_function_t *function = end_compiler();
 	return parser.had_error ? NULL : function;
 }
+
+void mark_compiler_roots()
+{
+	struct compiler *compiler = current;
+	while (compiler) {
+		mark_object((obj_t *)compiler->function);
+		compiler = compiler->enclosing;
+	}
+}
@@ -6,5 +6,7 @@
 #include "object.h"
 
 obj_function_t *compile(const char *src);
+/* functions still being compiled are gc roots*/
+void mark_compiler_roots();
 
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "debug.h"
 #include "value.h"
+#include "vm.h"
 
 static int simple_instruction(const char *name, int offset)
 {
@@ -16,6 +17,24 @@ static int constant_instruction(const char *name, struct chunk *c, int offset)
 	return offset + 2;
 }
 
+static int global_instruction(const char *name, struct chunk *c, int offset)
+{
+	uint8_t slot = c->code[offset + 1];
+	printf("%-16s %4d '%s'\n", name, slot, vm->globals[slot].name->chars);
+	return offset + 2;
+}
+
+static int long_global_instruction(const char *name, struct chunk *c,
+				   int offset)
+{
+	uint32_t slot = c->code[offset + 1];
+	slot = (slot << 8) | c->code[offset + 2];
+	slot = (slot << 8) | c->code[offset + 3];
+
+	printf("%-16s %4d '%s'\n", name, slot, vm->globals[slot].name->chars);
+	return offset + 4;
+}
+
 static int byte_instruction(const char *name, struct chunk *c, int offset)
 {
 	uint8_t slot = c->code[offset + 1];
@@ -33,6 +52,36 @@ static int jump_instruction(const char *name, int sign, struct chunk *c,
 	return offset + 3;
 }
 
+static int locals_instruction(const char *name, struct chunk *c, int offset)
+{
+	printf("%-16s %4d %4d\n", name, c->code[offset + 1],
+	       c->code[offset + 2]);
+	return offset + 3;
+}
+
+static int local_constant_instruction(const char *name, struct chunk *c,
+				      int offset)
+{
+	uint8_t const_idx = c->code[offset + 2];
+	printf("%-16s %4d %4d '", name, c->code[offset + 1], const_idx);
+	print_value(c->constants.values[const_idx]);
+	printf("'\n");
+	return offset + 3;
+}
+
+static int local_constant_jump_instruction(const char *name, struct chunk *c,
+					   int offset)
+{
+	uint8_t const_idx = c->code[offset + 2];
+	uint16_t jmp = (uint16_t)(c->code[offset + 3] << 8);
+	jmp |= c->code[offset + 4];
+
+	printf("%-16s %4d %4d '", name, c->code[offset + 1], const_idx);
+	print_value(c->constants.values[const_idx]);
+	printf("' %d -> %d\n", offset, offset + 5 + jmp);
+	return offset + 5;
+}
+
 static int long_constant_instruction(const char *name, struct chunk *c,
 				     int offset)
 {
@@ -46,6 +95,61 @@ static int long_constant_instruction(const char *name, struct chunk *c,
 	return offset + 4;
 }
 
+static const char *opcode_names[] = {
+	[OP_RETURN] = "OP_RETURN",
+	[OP_CONSTANT] = "OP_CONSTANT",
+	[OP_NIL] = "OP_NIL",
+	[OP_FALSE] = "OP_FALSE",
+	[OP_TRUE] = "OP_TRUE",
+	[OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+	[OP_NEGATE] = "OP_NEGATE",
+	[OP_ADD] = "OP_ADD",
+	[OP_SUB] = "OP_SUB",
+	[OP_MULT] = "OP_MULT",
+	[OP_DIV] = "OP_DIV",
+	[OP_NOT] = "OP_NOT",
+	[OP_EQUAL] = "OP_EQUAL",
+	[OP_GREATER] = "OP_GREATER",
+	[OP_LESS] = "OP_LESS",
+	[OP_PRINT] = "OP_PRINT",
+	[OP_POP] = "OP_POP",
+	[OP_POPX] = "OP_POPX",
+	[OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+	[OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+	[OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+	[OP_GET_LOCAL] = "OP_GET_LOCAL",
+	[OP_SET_LOCAL] = "OP_SET_LOCAL",
+	[OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+	[OP_JUMP] = "OP_JUMP",
+	[OP_LOOP] = "OP_LOOP",
+	[OP_CALL] = "OP_CALL",
+	[OP_DEFINE_GLOBAL_LONG] = "OP_DEFINE_GLOBAL_LONG",
+	[OP_GET_GLOBAL_LONG] = "OP_GET_GLOBAL_LONG",
+	[OP_SET_GLOBAL_LONG] = "OP_SET_GLOBAL_LONG",
+	[OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+	[OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+	[OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+	[OP_JUMP_IF_FALSE_POP] = "OP_JUMP_IF_FALSE_POP",
+	[OP_LESS_JUMP] = "OP_LESS_JUMP",
+	[OP_ADD_LOCALS] = "OP_ADD_LOCALS",
+	[OP_ADD_LOCAL_CONST] = "OP_ADD_LOCAL_CONST",
+	[OP_SUB_LOCAL_CONST] = "OP_SUB_LOCAL_CONST",
+	[OP_LESS_LOCAL_CONST_JUMP] = "OP_LESS_LOCAL_CONST_JUMP",
+	[OP_SET_LOCAL_POP] = "OP_SET_LOCAL_POP",
+	[OP_SET_GLOBAL_POP] = "OP_SET_GLOBAL_POP",
+	[OP_TAIL_CALL] = "OP_TAIL_CALL",
+	[OP_ADD_NUM] = "OP_ADD_NUM",
+	[OP_ADD_STR] = "OP_ADD_STR",
+};
+
+const char *opcode_name(uint8_t op)
+{
+	if (op >= sizeof(opcode_names) / sizeof(opcode_names[0]) ||
+	    !opcode_names[op])
+		return "OP_UNKNOWN";
+	return opcode_names[op];
+}
+
 void disassemble_chunk(struct chunk *c, const char *name)
 {
 	printf("== %s ==\n", name);
@@ -106,11 +210,11 @@ int disassemble_instruction(struct chunk *c, int offset)
 	case OP_POPX:
 		return simple_instruction("OP_POPX", offset);
 	case OP_DEFINE_GLOBAL:
-		return constant_instruction("OP_DEFINE_GLOBAL", c, offset);
+		return global_instruction("OP_DEFINE_GLOBAL", c, offset);
 	case OP_GET_GLOBAL:
-		return constant_instruction("OP_GET_GLOBAL", c, offset);
+		return global_instruction("OP_GET_GLOBAL", c, offset);
 	case OP_SET_GLOBAL:
-		return constant_instruction("OP_SET_GLOBAL", c, offset);
+		return global_instruction("OP_SET_GLOBAL", c, offset);
 	case OP_GET_LOCAL:
 		return byte_instruction("OP_GET_LOCAL", c, offset);
 	case OP_SET_LOCAL:
@@ -123,6 +227,44 @@ int disassemble_instruction(struct chunk *c, int offset)
 		return jump_instruction("OP_LOOP", -1, c, offset);
 	case OP_CALL:
 		return byte_instruction("OP_CALL", c, offset);
+	case OP_DEFINE_GLOBAL_LONG:
+		return long_global_instruction("OP_DEFINE_GLOBAL_LONG", c,
+					       offset);
+	case OP_GET_GLOBAL_LONG:
+		return long_global_instruction("OP_GET_GLOBAL_LONG", c, offset);
+	case OP_SET_GLOBAL_LONG:
+		return long_global_instruction("OP_SET_GLOBAL_LONG", c, offset);
+	case OP_NOT_EQUAL:
+		return simple_instruction("OP_NOT_EQUAL", offset);
+	case OP_GREATER_EQUAL:
+		return simple_instruction("OP_GREATER_EQUAL", offset);
+	case OP_LESS_EQUAL:
+		return simple_instruction("OP_LESS_EQUAL", offset);
+	case OP_JUMP_IF_FALSE_POP:
+		return jump_instruction("OP_JUMP_IF_FALSE_POP", 1, c, offset);
+	case OP_LESS_JUMP:
+		return jump_instruction("OP_LESS_JUMP", 1, c, offset);
+	case OP_ADD_LOCALS:
+		return locals_instruction("OP_ADD_LOCALS", c, offset);
+	case OP_ADD_LOCAL_CONST:
+		return local_constant_instruction("OP_ADD_LOCAL_CONST", c,
+						  offset);
+	case OP_SUB_LOCAL_CONST:
+		return local_constant_instruction("OP_SUB_LOCAL_CONST", c,
+						  offset);
+	case OP_LESS_LOCAL_CONST_JUMP:
+		return local_constant_jump_instruction(
+			"OP_LESS_LOCAL_CONST_JUMP", c, offset);
+	case OP_SET_LOCAL_POP:
+		return byte_instruction("OP_SET_LOCAL_POP", c, offset);
+	case OP_SET_GLOBAL_POP:
+		return global_instruction("OP_SET_GLOBAL_POP", c, offset);
+	case OP_TAIL_CALL:
+		return byte_instruction("OP_TAIL_CALL", c, offset);
+	case OP_ADD_NUM:
+		return simple_instruction("OP_ADD_NUM", offset);
+	case OP_ADD_STR:
+		return simple_instruction("OP_ADD_STR", offset);
 	default:
 		printf("Unknown opcode %d\n", instr);
 		return offset + 1;
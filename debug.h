@@ -7,5 +7,6 @@
 void disassemble_chunk(struct chunk *c, const char *name);
 /* @ret: offset of the next instruction*/
 int disassemble_instruction(struct chunk *c, int offset);
+const char *opcode_name(uint8_t op);
 
 #endif
\ No newline at end of file
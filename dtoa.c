@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <string.h>
+#include "dtoa.h"
+
+/*
+ * Shortest digits that read back as the same double, after Florian
+ * Loitsch's Grisu2 ("Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers", PLDI 2010). Grisu2 always round-trips; for a tiny share of
+ * inputs it gives one digit more than the shortest possible.
+ *
+ * A double is scaled by a cached power of ten into a range where its
+ * digits, and those of the halfway points to its neighbours, can be cut
+ * out of 64-bit integers.
+ */
+
+struct diy_fp {
+	uint64_t f;
+	int e; /* value is f * 2^e */
+};
+
+/* 10^k for k = -348, -340, ..., 340, as normalized diy_fps*/
+static const uint64_t cached_powers_f[] = {
+	0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+	0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+	0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+	0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+	0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+	0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+	0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+	0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+	0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+	0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+	0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+	0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+	0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+	0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+	0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+	0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+	0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+	0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+	0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+	0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+	0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+	0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+	0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+	0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+	0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+	0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+	0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+	0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+	0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const int16_t cached_powers_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+	-954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+	-688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+	-422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+	-157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+	109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+	641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+	907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint64_t pow10[] = {
+	1ull,
+	10ull,
+	100ull,
+	1000ull,
+	10000ull,
+	100000ull,
+	1000000ull,
+	10000000ull,
+	100000000ull,
+	1000000000ull,
+	10000000000ull,
+	100000000000ull,
+	1000000000000ull,
+	10000000000000ull,
+	100000000000000ull,
+	1000000000000000ull,
+	10000000000000000ull,
+	100000000000000000ull,
+	1000000000000000000ull,
+	10000000000000000000ull,
+};
+
+static struct diy_fp normalize(struct diy_fp x)
+{
+	while (!(x.f & (1ull << 63))) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+/* the high 64 bits of the product, rounded*/
+static struct diy_fp multiply(struct diy_fp x, struct diy_fp y)
+{
+	const uint64_t mask = 0xffffffffull;
+	uint64_t a = x.f >> 32, b = x.f & mask;
+	uint64_t c = y.f >> 32, d = y.f & mask;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t mid = (bd >> 32) + (ad & mask) + (bc & mask);
+	mid += 1ull << 31;
+
+	struct diy_fp r = { ac + (ad >> 32) + (bc >> 32) + (mid >> 32),
+			    x.e + y.e + 64 };
+	return r;
+}
+
+/* move the last digit down while that brings it closer to the exact value
+ * and stays inside the round-trip interval*/
+static void round_digit(char *digits, int len, uint64_t delta, uint64_t rest,
+			uint64_t ten_kappa, uint64_t wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+	       (rest + ten_kappa < wp_w ||
+		wp_w - rest > rest + ten_kappa - wp_w)) {
+		digits[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+static int count_digits(uint32_t n)
+{
+	int count = 1;
+	while (n >= 10) {
+		n /= 10;
+		count++;
+	}
+	return count;
+}
+
+/* generate digits of w until they are inside the interval of width delta
+ * below mp*/
+static void generate_digits(struct diy_fp w, struct diy_fp mp, uint64_t delta,
+			    char *digits, int *len, int *k)
+{
+	struct diy_fp one = { 1ull << -mp.e, mp.e };
+	uint64_t wp_w = mp.f - w.f;
+	uint32_t p1 = (uint32_t)(mp.f >> -one.e); /* integral part*/
+	uint64_t p2 = mp.f & (one.f - 1); /* fractional part*/
+	int kappa = count_digits(p1);
+	*len = 0;
+
+	while (kappa > 0) {
+		uint32_t d = p1 / pow10[kappa - 1];
+		p1 %= pow10[kappa - 1];
+		if (d || *len)
+			digits[(*len)++] = (char)('0' + d);
+		kappa--;
+
+		uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			round_digit(digits, *len, delta, rest,
+				    pow10[kappa] << -one.e, wp_w);
+			return;
+		}
+	}
+
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		char d = (char)(p2 >> -one.e);
+		if (d || *len)
+			digits[(*len)++] = (char)('0' + d);
+		p2 &= one.f - 1;
+		kappa--;
+
+		if (p2 < delta) {
+			*k += kappa;
+			int index = -kappa;
+			round_digit(digits, *len, delta, p2, one.f,
+				    wp_w * (index < 20 ? pow10[index] : 0));
+			return;
+		}
+	}
+}
+
+/* digits of a positive finite v, which is digits * 10^k*/
+static void grisu2(double v, char *digits, int *len, int *k)
+{
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	int biased_e = (int)(bits >> 52) & 0x7ff;
+	uint64_t significand = bits & ((1ull << 52) - 1);
+
+	struct diy_fp w;
+	if (biased_e) {
+		w.f = significand | (1ull << 52);
+		w.e = biased_e - 1075;
+	} else {
+		w.f = significand;
+		w.e = -1074;
+	}
+
+	/* halfway to the next double up and down. Below a power of two the
+	 * next double down is only half as far*/
+	struct diy_fp plus = normalize((struct diy_fp){ (w.f << 1) + 1, w.e - 1 });
+	struct diy_fp minus;
+	if (w.f == 1ull << 52)
+		minus = (struct diy_fp){ (w.f << 2) - 1, w.e - 2 };
+	else
+		minus = (struct diy_fp){ (w.f << 1) - 1, w.e - 1 };
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	/* a power of ten that brings plus's exponent into [-60, -32]*/
+	double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+	int ik = (int)dk;
+	if (dk - ik > 0.0)
+		ik++;
+	unsigned index = (unsigned)((ik >> 3) + 1);
+	*k = -(-348 + (int)(index << 3));
+	struct diy_fp c = { cached_powers_f[index], cached_powers_e[index] };
+
+	struct diy_fp scaled = multiply(normalize(w), c);
+	struct diy_fp scaled_plus = multiply(plus, c);
+	struct diy_fp scaled_minus = multiply(minus, c);
+	/* stay strictly inside the interval, whatever the rounding errors*/
+	scaled_minus.f++;
+	scaled_plus.f--;
+
+	generate_digits(scaled, scaled_plus, scaled_plus.f - scaled_minus.f,
+			digits, len, k);
+}
+
+static int write_integer(char *buf, uint64_t n)
+{
+	char tmp[20];
+	int len = 0;
+	do {
+		tmp[len++] = (char)('0' + n % 10);
+		n /= 10;
+	} while (n);
+
+	for (int i = 0; i < len; i++)
+		buf[i] = tmp[len - 1 - i];
+	return len;
+}
+
+/* printf's style of exponent: a sign and at least two digits*/
+static int write_exponent(char *buf, int exp)
+{
+	int len = 0;
+	buf[len++] = 'e';
+	buf[len++] = exp < 0 ? '-' : '+';
+	if (exp < 0)
+		exp = -exp;
+	if (exp < 10)
+		buf[len++] = '0';
+	return len + write_integer(buf + len, (uint64_t)exp);
+}
+
+/* lay out digits * 10^k: plain decimals from 0.0001 up to 10^21, like %g
+ * at the low end, and scientific notation beyond*/
+static int layout(char *buf, const char *digits, int len, int k)
+{
+	int exp = len + k - 1; /* of the first digit*/
+	int n = 0;
+
+	if (exp >= 21 || exp < -4) {
+		buf[n++] = digits[0];
+		if (len > 1) {
+			buf[n++] = '.';
+			memcpy(buf + n, digits + 1, len - 1);
+			n += len - 1;
+		}
+		return n + write_exponent(buf + n, exp);
+	}
+
+	if (exp < 0) {
+		buf[n++] = '0';
+		buf[n++] = '.';
+		for (int i = -1; i > exp; i--)
+			buf[n++] = '0';
+		memcpy(buf + n, digits, len);
+		return n + len;
+	}
+
+	if (k >= 0) {
+		memcpy(buf, digits, len);
+		memset(buf + len, '0', k);
+		return len + k;
+	}
+
+	memcpy(buf, digits, exp + 1);
+	buf[exp + 1] = '.';
+	memcpy(buf + exp + 2, digits + exp + 1, len - exp - 1);
+	return len + 1;
+}
+
+int format_number(double d, char *buf)
+{
+	if (d != d || d - d != 0) /* NaN and infinities*/
+		return snprintf(buf, NUMBER_BUFFER_SIZE, "%g", d);
+
+	int n = 0;
+	if (d < 0 || (d == 0 && 1 / d < 0)) {
+		buf[n++] = '-';
+		d = -d;
+	}
+
+	/* integers print digit for digit as long as doubles hold them all*/
+	if (d < 9007199254740992.0 && d == (double)(uint64_t)d)
+		return n + write_integer(buf + n, (uint64_t)d);
+
+	char digits[18];
+	int len, k;
+	grisu2(d, digits, &len, &k);
+	return n + layout(buf + n, digits, len, k);
+}
+
+int format_number_g(double d, char *buf)
+{
+	/* %g keeps six significant digits, so smaller integers print in full*/
+	if (d > -1e6 && d < 1e6 && d == (int32_t)d && !(d == 0 && 1 / d < 0)) {
+		if (d >= 0)
+			return write_integer(buf, (uint64_t)d);
+		buf[0] = '-';
+		return 1 + write_integer(buf + 1, (uint64_t)-d);
+	}
+	return snprintf(buf, NUMBER_BUFFER_SIZE, "%g", d);
+}
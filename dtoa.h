@@ -0,0 +1,16 @@
+#ifndef CLOX_DTOA_H
+#define CLOX_DTOA_H
+
+#include "common.h"
+
+/* room for any number either function writes, without a terminator*/
+#define NUMBER_BUFFER_SIZE 32
+
+/* the shortest digits that read back as d, in plain decimal notation from
+ * 0.0001 up to 1e21 and in scientific notation outside that. Returns the
+ * length written*/
+int format_number(double d, char *buf);
+/* exactly what printf's %g writes for d*/
+int format_number_g(double d, char *buf);
+
+#endif
@@ -1,14 +1,21 @@
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
 #include "vm.h"
+#include "compiler.h"
+#include "cache.h"
+#include "batch.h"
+#include "source.h"
 
 static void repl()
 {
-	vm.repl_mode = true;
+	vm->repl_mode = true;
 	char line[1024];
 
 	for (;;) {
@@ -19,66 +26,333 @@ static void repl()
 			break;
 		}
 		interpret_vm(line);
+		flush_output(&vm->out);
 	}
 }
 
-static char *read_file(const char *path)
+static void read_file(const char *path, struct source *s)
 {
-	FILE *file = fopen(path, "rb");
-
-	if (!file) {
-		fprintf(stderr, "Couldn't open file \"%s\".", path);
+	if (!load_source(vm, path, s)) {
+		fprintf(stderr, "Couldn't read file \"%s\": %s.\n", path,
+			strerror(errno));
 		exit(74);
 	}
+}
+
+/* the cache for script.lox is script.loxc*/
+static char *cache_path(const char *path)
+{
+	size_t len = strlen(path);
+	char *r = malloc(len + 2);
+	memcpy(r, path, len);
+	r[len] = 'c';
+	r[len + 1] = '\0';
+	return r;
+}
+
+static bool is_cache_file(const char *path)
+{
+	size_t len = strlen(path);
+	return len > 5 && strcmp(path + len - 5, ".loxc") == 0;
+}
+
+static int run_file(const char *path)
+{
+	/* one program, run once*/
+	vm->use_arenas = true;
+
+	if (is_cache_file(path)) {
+		obj_function_t *script = load_cache(path, 0);
+		if (!script) {
+			fprintf(stderr, "Couldn't load bytecode from \"%s\".\n",
+				path);
+			return 74;
+		}
+		return exit_status(interpret_function(script));
+	}
+
+	struct source source;
+	read_file(path, &source);
+
+	/* skip compiling if an up to date cache sits next to the script*/
+	char *cached = cache_path(path);
+	obj_function_t *script =
+		load_cache(cached, hash_source(source.chars, source.length));
+	free(cached);
+
+	interpret_result_t r = script ? interpret_function(script) :
+					interpret_vm(source.chars);
+	free_source(&source);
+
+	return exit_status(r);
+}
+
+static int compile_file(const char *path, const char *out)
+{
+	struct source source;
+	read_file(path, &source);
+	obj_function_t *script = compile(source.chars);
+
+	if (!script) {
+		free_source(&source);
+		return 65;
+	}
+
+	char *cached = out ? NULL : cache_path(path);
+	if (!out)
+		out = cached;
+
+	int status = 0;
+	if (!write_cache(script, out,
+			 hash_source(source.chars, source.length))) {
+		fprintf(stderr, "Couldn't write \"%s\".\n", out);
+		status = 74;
+	}
+
+	free(cached);
+	free_source(&source);
+	return status;
+}
+
+/* stdin read in large blocks and cut into lines in place. A line is only
+ * moved when it straddles two blocks*/
+struct line_reader {
+	char *buf;
+	size_t capacity;
+	size_t start; /* first byte not handed out yet */
+	size_t end; /* end of the bytes read */
+	bool eof;
+};
+
+#define LINE_BLOCK (64 * 1024)
+
+/* the next line, without its newline. Returns false at the end of input*/
+static bool read_line(struct line_reader *r, char **line, size_t *length)
+{
+	for (;;) {
+		char *p = r->buf + r->start;
+		char *nl = memchr(p, '\n', r->end - r->start);
+
+		if (nl || (r->eof && r->start < r->end)) {
+			*line = p;
+			*length = nl ? (size_t)(nl - p) : r->end - r->start;
+			r->start += *length + (nl != NULL);
+			return true;
+		}
+		if (r->eof)
+			return false;
+
+		memmove(r->buf, p, r->end - r->start);
+		r->end -= r->start;
+		r->start = 0;
+		if (r->end == r->capacity) {
+			r->capacity *= 2;
+			r->buf = realloc(r->buf, r->capacity);
+			if (!r->buf) {
+				fprintf(stderr, "Not enough memory to read\n");
+				exit(74);
+			}
+		}
+
+		size_t n = fread(r->buf + r->end, 1, r->capacity - r->end,
+				 stdin);
+		r->end += n;
+		r->eof = n == 0;
+	}
+}
+
+/* compile the script once, then call handler with every line of stdin.
+ * Whatever the handler returns, nil aside, is written out as a line*/
+static int run_each(const char *path, const char *handler, bool stats)
+{
+	struct source source;
+	read_file(path, &source);
+	obj_function_t *script = vm_compile(vm, source.chars);
+	free_source(&source);
 
-	fseek(file, 0L, SEEK_END);
-	size_t file_size = ftell(file);
-	rewind(file);
+	if (!script)
+		return 65;
+	interpret_result_t r = vm_run(vm, script);
+	if (r != INTERPRET_OK)
+		return exit_status(r);
 
-	char *buf = malloc(file_size + 1);
+	int slot = vm_global_slot(vm, handler);
+	if (!vm->globals[slot].defined) {
+		fprintf(stderr, "No function '%s' to call.\n", handler);
+		return 70;
+	}
 
-	if (!buf) {
+	struct line_reader reader = { .capacity = LINE_BLOCK };
+	reader.buf = malloc(reader.capacity);
+	if (!reader.buf) {
 		fprintf(stderr, "Not enough memory to read\n");
 		exit(74);
 	}
-	size_t bytes_read = fread(buf, sizeof(char), file_size, file);
 
-	if (bytes_read < file_size) {
-		fprintf(stderr, "Couldn't read file\n");
-		exit(74);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t records = 0;
+	size_t bytes = 0;
+	char *line;
+	size_t length;
+
+	while (read_line(&reader, &line, &length)) {
+		value_t result;
+
+		if (!vm_push_global(vm, slot) ||
+		    !vm_push_string(vm, line, (int)length)) {
+			fprintf(stderr, "Stack Overflow.\n");
+			r = INTERPRET_RUNTIME_ERROR;
+			break;
+		}
+		r = vm_call(vm, 1, &result);
+		if (r != INTERPRET_OK) {
+			fprintf(stderr, "[record %zu]\n", records + 1);
+			break;
+		}
+
+		if (!IS_NIL(result)) {
+			output_value(&vm->out, result);
+			output_char(&vm->out, '\n');
+		}
+		records++;
+		bytes += length + 1;
+	}
+
+	flush_output(&vm->out);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(reader.buf);
+
+	if (stats) {
+		double seconds = (end.tv_sec - start.tv_sec) +
+				 (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr,
+			"each: %zu records, %zu bytes in %.3f s, "
+			"%.0f records/s, %zu collections\n",
+			records, bytes, seconds,
+			seconds > 0 ? records / seconds : 0.0,
+			vm->gc_stats.collections);
 	}
-	buf[bytes_read] = '\0';
 
-	fclose(file);
-	return buf;
+	return exit_status(r);
+}
+
+static void usage()
+{
+	fprintf(stderr, "Usage: clox [--gc-stats] [--no-quicken] [--max-frames n] "
+			"[--flush line|block|exit] [--print-g] [path]\n"
+			"       clox --compile-only [-o out.loxc] path\n"
+			"       clox --batch [--jobs n] path|dir...\n"
+			"       clox --each [--handler name] [--stats] path\n");
+	exit(64);
 }
 
-static void run_file(const char *path)
+static int parse_flush_policy(const char *name)
 {
-	char *source = read_file(path);
-	interpret_result_t r = interpret_vm(source);
-	free(source);
-
-	if (r == INTERPRET_COMPILE_ERROR)
-		exit(65);
-	if (r == INTERPRET_RUNTIME_ERROR)
-		exit(70);
+	if (strcmp(name, "line") == 0)
+		return FLUSH_LINE;
+	if (strcmp(name, "block") == 0)
+		return FLUSH_BLOCK;
+	if (strcmp(name, "exit") == 0)
+		return FLUSH_EXIT;
+	usage();
+	return -1;
 }
 
 int main(int argc, char *argv[])
 {
-	init_vm();
+	const char *path = NULL;
+	const char *out = NULL;
+	bool gc_stats = false;
+	bool compile_only = false;
+	bool quicken = true;
+	int max_frames = FRAMES_MAX;
+	bool batch = false;
+	int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	const char **paths = malloc(sizeof(char *) * argc);
+	int path_count = 0;
+	bool each = false;
+	const char *handler = NULL;
+	bool stats = false;
+	int flush = -1;
+	bool print_g = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--gc-stats") == 0)
+			gc_stats = true;
+		else if (strcmp(argv[i], "--no-quicken") == 0)
+			quicken = false;
+		else if (strcmp(argv[i], "--max-frames") == 0 && i + 1 < argc)
+			max_frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--compile-only") == 0)
+			compile_only = true;
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			out = argv[++i];
+		else if (strcmp(argv[i], "--batch") == 0)
+			batch = true;
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+			jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--each") == 0)
+			each = true;
+		else if (strcmp(argv[i], "--handler") == 0 && i + 1 < argc)
+			handler = argv[++i];
+		else if (strcmp(argv[i], "--stats") == 0)
+			stats = true;
+		else if (strcmp(argv[i], "--flush") == 0 && i + 1 < argc)
+			flush = parse_flush_policy(argv[++i]);
+		else if (strcmp(argv[i], "--print-g") == 0)
+			print_g = true;
+		else if (argv[i][0] == '-')
+			usage();
+		else
+			paths[path_count++] = argv[i];
+	}
+
+	if (path_count > 1 && !batch)
+		usage();
+	if (path_count == 1)
+		path = paths[0];
 
-	if (argc == 1) {
+	if ((compile_only || out) && (!path || !compile_only))
+		usage();
+	if (batch && (compile_only || !path_count || jobs < 1))
+		usage();
+	if (each && (batch || compile_only || !path))
+		usage();
+	if ((handler || stats) && !each)
+		usage();
+	if (max_frames < 1)
+		usage();
+	/* records are many and small: write them in large blocks*/
+	if (each && flush == -1)
+		flush = FLUSH_BLOCK;
+
+	vm = vm_new();
+	vm->quicken = quicken;
+	vm->max_frames = max_frames;
+	vm->out.g_format = print_g;
+	if (flush != -1)
+		vm->out.policy = flush;
+
+	int status = 0;
+	if (batch)
+		status = run_batch(paths, path_count, jobs);
+	else if (each)
+		status = run_each(path, handler ? handler : "handle", stats);
+	else if (compile_only)
+		status = compile_file(path, out);
+	else if (!path)
 		repl();
-	} else if (argc == 2) {
-		run_file(argv[1]);
-	} else {
-		fprintf(stderr, "Usage: clox [path]\n");
-		exit(64);
+	else
+		status = run_file(path);
+
+	if (gc_stats) {
+		flush_output(&vm->out);
+		print_gc_stats();
 	}
 
-	free_vm();
+	vm_free(vm);
+	free(paths);
 
-	return 0;
-}
\ No newline at end of file
+	return status;
+}
@@ -1,22 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
 #include "memory.h"
+#include "compiler.h"
 #include "object.h"
 #include "vm.h"
 
+#ifdef DEBUG_LOG_GC
+#include "debug.h"
+#endif
+
+#ifdef POOL_ALLOC
+static size_t size_class(size_t size)
+{
+	return (size - 1) / POOL_GRANULE;
+}
+
+static void *pool_alloc(struct pool *pool, size_t size)
+{
+	size_t k = size_class(size);
+	void *slot = pool->free[k];
+	if (slot) {
+		pool->free[k] = *(void **)slot;
+		return slot;
+	}
+	return arena_alloc(&pool->pages, (k + 1) * POOL_GRANULE, POOL_GRANULE);
+}
+
+static void pool_free(struct pool *pool, void *p, size_t size)
+{
+	size_t k = size_class(size);
+	*(void **)p = pool->free[k];
+	pool->free[k] = p;
+}
+#endif
+
+static void *resize(void *p, size_t new_size)
+{
+	void *r = realloc(p, new_size);
+	if (!r) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+	return r;
+}
+
 void *reallocate(void *p, size_t old_size, size_t new_size)
 {
+	vm->bytes_allocated += new_size - old_size;
+
+	if (new_size > old_size) {
+#ifdef DEBUG_STRESS_GC
+		collect_garbage();
+#else
+		if (vm->bytes_allocated > vm->next_gc)
+			collect_garbage();
+#endif
+	}
+
+#ifdef POOL_ALLOC
+	/* every caller passes the size it allocated, so that alone tells a
+	 * pooled block from a malloced one*/
+	assert(!p || old_size);
+	bool pooled = p && old_size <= POOL_MAX;
+	if (p && !pooled && new_size > POOL_MAX)
+		return resize(p, new_size);
+	if (pooled && new_size && new_size <= POOL_MAX &&
+	    size_class(new_size) == size_class(old_size))
+		return p;
+
+	void *r = NULL;
+	if (new_size > POOL_MAX)
+		r = resize(NULL, new_size);
+	else if (new_size)
+		r = pool_alloc(&vm->pool, new_size);
+
+	if (p) {
+		if (r)
+			memcpy(r, p, old_size < new_size ? old_size : new_size);
+		if (pooled)
+			pool_free(&vm->pool, p, old_size);
+		else
+			free(p);
+	}
+	return r;
+#else
 	if (!new_size) {
 		free(p);
 		return NULL;
 	}
-	return realloc(p, new_size);
+	return resize(p, new_size);
+#endif
+}
+
+void mark_object(struct obj *obj)
+{
+	if (!obj || obj->is_marked)
+		return;
+
+#ifdef DEBUG_LOG_GC
+	printf("%p mark ", (void *)obj);
+	print_value(OBJ(obj));
+	printf("\n");
+#endif
+
+	obj->is_marked = true;
+
+	/* the gray stack is owned by the collector and must not recurse into
+	 * reallocate*/
+	if (vm->gray_count + 1 > vm->gray_capacity) {
+		vm->gray_capacity = GROW_CAPACITY(vm->gray_capacity);
+		vm->gray_stack = realloc(vm->gray_stack,
+					sizeof(struct obj *) * vm->gray_capacity);
+		if (!vm->gray_stack) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(74);
+		}
+	}
+
+	vm->gray_stack[vm->gray_count++] = obj;
+}
+
+void mark_value(value_t value)
+{
+	if (IS_OBJ(value))
+		mark_object(AS_OBJ(value));
+}
+
+static void mark_array(struct value_array *a)
+{
+	for (int i = 0; i < a->count; i++)
+		mark_value(a->values[i]);
+}
+
+static void blacken_object(struct obj *obj)
+{
+#ifdef DEBUG_LOG_GC
+	printf("%p blacken ", (void *)obj);
+	print_value(OBJ(obj));
+	printf("\n");
+#endif
+
+	switch (obj->type) {
+	case OBJ_FUNCTION: {
+		obj_function_t *f = (obj_function_t *)obj;
+		mark_object((struct obj *)f->name);
+		mark_array(&f->chunk.constants);
+		break;
+	}
+	case OBJ_ROPE: {
+		obj_rope_t *r = (obj_rope_t *)obj;
+		mark_object(r->left);
+		mark_object(r->right);
+		mark_object((struct obj *)r->flat);
+		break;
+	}
+	case OBJ_STRING:
+	case OBJ_NATIVE:
+		break;
+	}
 }
 
 static void free_object(struct obj *obj)
 {
+#ifdef DEBUG_LOG_GC
+	printf("%p free type %d\n", (void *)obj, obj->type);
+#endif
+
 	switch (obj->type) {
 	case OBJ_STRING: {
 		obj_string_t *s = (obj_string_t *)obj;
-		FREE_ARRAY(char, s->chars, s->length + 1);
+		if (!s->borrowed)
+			FREE_ARRAY(char, s->chars, s->length + 1);
 		FREE(obj_string_t, obj);
 		break;
 	}
@@ -28,17 +184,209 @@ static void free_object(struct obj *obj)
 		break;
 	}
 	case OBJ_NATIVE:
-		FREE(OBJ_NATIVE, obj);
+		FREE(obj_native_t, obj);
+		break;
+	case OBJ_ROPE:
+		FREE(obj_rope_t, obj);
 		break;
 	}
 }
 
+static void mark_roots()
+{
+	for (value_t *slot = vm->stack; slot < vm->stack_top; slot++)
+		mark_value(*slot);
+
+	for (int i = 0; i < vm->frame_count; i++)
+		mark_object((struct obj *)vm->frames[i].function);
+
+	mark_table(&vm->global_names);
+	mark_array(&vm->handles);
+	for (int i = 0; i < vm->global_count; i++) {
+		mark_value(vm->globals[i].value);
+		mark_object((struct obj *)vm->globals[i].name);
+	}
+	mark_compiler_roots();
+}
+
+static void trace_references()
+{
+	while (vm->gray_count > 0) {
+		struct obj *obj = vm->gray_stack[--vm->gray_count];
+		blacken_object(obj);
+	}
+}
+
+static void sweep()
+{
+	struct obj *prev = NULL;
+	struct obj *obj = vm->objects;
+
+	while (obj) {
+		if (obj->is_marked) {
+			obj->is_marked = false;
+			prev = obj;
+			obj = obj->next;
+			continue;
+		}
+
+		struct obj *unreached = obj;
+		obj = obj->next;
+		if (prev)
+			prev->next = obj;
+		else
+			vm->objects = obj;
+
+		free_object(unreached);
+	}
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void collect_garbage()
+{
+#ifdef DEBUG_LOG_GC
+	printf("-- gc begin\n");
+#endif
+	double start = now();
+	size_t before = vm->bytes_allocated;
+
+	mark_roots();
+	trace_references();
+	/* interned strings are weak references: drop the ones nothing else
+	 * reached before their memory is swept*/
+	table_remove_white(&vm->strings);
+	sweep();
+
+	vm->next_gc = vm->bytes_allocated * GC_HEAP_GROW_FACTOR;
+	if (vm->next_gc < GC_INITIAL_THRESHOLD)
+		vm->next_gc = GC_INITIAL_THRESHOLD;
+
+	double pause = now() - start;
+	vm->gc_stats.collections++;
+	vm->gc_stats.bytes_freed += before - vm->bytes_allocated;
+	vm->gc_stats.total_pause += pause;
+	if (pause > vm->gc_stats.max_pause)
+		vm->gc_stats.max_pause = pause;
+
+#ifdef DEBUG_LOG_GC
+	printf("-- gc end\n");
+	printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+	       before - vm->bytes_allocated, before, vm->bytes_allocated,
+	       vm->next_gc);
+#endif
+}
+
 void free_objects()
 {
-	struct obj *obj = vm.objects;
+	struct obj *obj = vm->objects;
 	while (obj) {
 		struct obj *nxt = obj->next;
 		free_object(obj);
 		obj = nxt;
 	}
-}
\ No newline at end of file
+	vm->objects = NULL;
+
+	free(vm->gray_stack);
+	vm->gray_stack = NULL;
+	vm->gray_count = 0;
+	vm->gray_capacity = 0;
+}
+
+void print_gc_stats()
+{
+	struct gc_stats *s = &vm->gc_stats;
+	fprintf(stderr, "gc: %zu collections, %zu bytes freed, %zu bytes live\n",
+		s->collections, s->bytes_freed, vm->bytes_allocated);
+	fprintf(stderr, "gc: pause total %.3f ms, max %.3f ms, mean %.3f ms\n",
+		s->total_pause * 1e3, s->max_pause * 1e3,
+		s->collections ? s->total_pause * 1e3 / s->collections : 0.0);
+}
+
+void init_arena(struct arena *a)
+{
+	a->blocks = NULL;
+	a->bytes = 0;
+}
+
+static struct arena_block *new_block(size_t size)
+{
+	struct arena_block *b = malloc(sizeof(struct arena_block) + size);
+	if (!b) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+void *arena_alloc(struct arena *a, size_t size, size_t align)
+{
+	if (!size)
+		return NULL;
+	a->bytes += size;
+
+	struct arena_block *b = a->blocks;
+	if (b) {
+		uintptr_t start = (uintptr_t)b->data + b->used;
+		size_t pad = (align - start % align) % align;
+		if (b->used + pad + size <= b->size) {
+			b->used += pad + size;
+			return (void *)(start + pad);
+		}
+	}
+
+	/* a big request gets a block to itself, after the one being filled so
+	 * its room isn't given up*/
+	if (size > ARENA_BLOCK / 4) {
+		struct arena_block *big = new_block(size + align - 1);
+		uintptr_t start = (uintptr_t)big->data;
+		big->used = big->size;
+		if (b) {
+			big->next = b->next;
+			b->next = big;
+		} else {
+			big->next = NULL;
+			a->blocks = big;
+		}
+		return (void *)(start + (align - start % align) % align);
+	}
+
+	b = new_block(ARENA_BLOCK);
+	b->next = a->blocks;
+	a->blocks = b;
+	uintptr_t start = (uintptr_t)b->data;
+	size_t pad = (align - start % align) % align;
+	b->used = pad + size;
+	return (void *)(start + pad);
+}
+
+void free_arena(struct arena *a)
+{
+	struct arena_block *b = a->blocks;
+	while (b) {
+		struct arena_block *next = b->next;
+		free(b);
+		b = next;
+	}
+	init_arena(a);
+}
+
+void init_pool(struct pool *p)
+{
+	init_arena(&p->pages);
+	for (int i = 0; i < POOL_CLASSES; i++)
+		p->free[i] = NULL;
+}
+
+void free_pool(struct pool *p)
+{
+	free_arena(&p->pages);
+	init_pool(p);
+}
@@ -4,27 +4,95 @@
 #include <string.h>
 
 #include "common.h"
+#include "value.h"
 
 #define GROW_CAPACITY(c) ((c) < 8 ? 8 : (c)*2)
 #define GROW_ARRAY(array, type, old_cnt, cnt) \
-	(type *)reallocate((array), sizeof(type) * old_cnt, sizeof(type) * cnt)
+	(type *)reallocate((array), sizeof(type) * (old_cnt), \
+			   sizeof(type) * (cnt))
 
 #define FREE_ARRAY(type, array, old_cnt) \
-	(type *)reallocate((array), sizeof(type) * old_cnt, 0)
-
-#define ZERO_INITIALIZE(array, type, old_l, new_l) \
-	memset((array), 0, ((new_l) - (old_l)) * sizeof(type))
+	(type *)reallocate((array), sizeof(type) * (old_cnt), 0)
 
 #define ALLOCATE(type, cnt) (type *)reallocate(NULL, 0, sizeof(type) * (cnt))
 #define FREE(type, obj) reallocate(obj, sizeof(type), 0)
 
+/* heap size at which the first collection runs*/
+#ifndef GC_INITIAL_THRESHOLD
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+#endif
+
+/* after a collection, the next one runs once the live heap has grown by this
+ * factor*/
+#ifndef GC_HEAP_GROW_FACTOR
+#define GC_HEAP_GROW_FACTOR 2
+#endif
+
+struct gc_stats {
+	size_t collections;
+	size_t bytes_freed;
+	double total_pause; /* seconds spent in collect_garbage()*/
+	double max_pause;
+};
+
 /*
  * All memory allocations/deallocations should be routed through reallocate.
  * This will make it easier to track memory in our garbage collector. To
- * deallocate, just pass in 0 for new_size.
+ * deallocate, just pass in 0 for new_size. old_size must be the size p was
+ * allocated with, it also tells which pool, if any, p came from.
  */
 
 void *reallocate(void *p, size_t old_size, size_t new_size);
+void mark_object(obj_t *obj);
+void mark_value(value_t value);
+void collect_garbage();
 void free_objects();
+void print_gc_stats();
+
+/* blocks an arena hands out memory from, unless a request is big enough to
+ * get an exact-size block of its own*/
+#ifndef ARENA_BLOCK
+#define ARENA_BLOCK (64 * 1024)
+#endif
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	unsigned char data[];
+};
+
+/* memory handed out in order and given back all at once. Finalized chunks
+ * live in arenas, so the code of a program sits together rather than
+ * scattered over the heap. The blocks don't count towards the gc's heap:
+ * nothing in them is freed before vm_reset or vm_free, however much of the
+ * code is collected. So only a vm with use_arenas set finalizes chunks, for
+ * hosts that run one program between resets. The REPL and vm_compile leave
+ * it off: they may compile without end, and their chunks keep arrays of
+ * their own that go with their functions*/
+struct arena {
+	struct arena_block *blocks; /* the one being filled comes first */
+	size_t bytes; /* handed out so far */
+};
+
+void init_arena(struct arena *a);
+/* NULL for a size of 0*/
+void *arena_alloc(struct arena *a, size_t size, size_t align);
+void free_arena(struct arena *a);
+
+/* with POOL_ALLOC, reallocate serves sizes up to POOL_MAX from classes
+ * POOL_GRANULE bytes apart. A class reuses its freed slots first and carves
+ * new ones from the pool's arena; the memory goes back with the vm*/
+#define POOL_GRANULE 16
+#define POOL_MAX 256
+#define POOL_CLASSES (POOL_MAX / POOL_GRANULE)
+
+struct pool {
+	struct arena pages;
+	void *free[POOL_CLASSES]; /* freed slots, each holding the next */
+};
+
+void init_pool(struct pool *p);
+void free_pool(struct pool *p);
 
 #endif
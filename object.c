@@ -4,33 +4,41 @@
 
 #include "object.h"
 #include "memory.h"
+#include "output.h"
 #include "value.h"
 #include "vm.h"
 
 #define ALLOCATE_OBJ(type, obj_type) \
 	(type *)allocate_object(sizeof(type), obj_type)
 
-static void print_function(obj_function_t *f)
+static void print_function(struct output *out, obj_function_t *f)
 {
 	if (f->name == NULL) {
-		printf("<script>");
+		output_write(out, "<script>", 8);
 		return;
 	}
-	printf("<fn %s>", f->name->chars);
+	output_write(out, "<fn ", 4);
+	output_write(out, f->name->chars, f->name->length);
+	output_char(out, '>');
 }
 
-void print_object(value_t val)
+void output_object(struct output *out, value_t val)
 {
 	switch (OBJ_TYPE(val)) {
 	case OBJ_STRING:
-		printf("%s", AS_CSTRING(val));
+		output_write(out, AS_CSTRING(val), AS_STRING(val)->length);
 		break;
 	case OBJ_FUNCTION:
-		print_function(AS_FUNCTION(val));
+		print_function(out, AS_FUNCTION(val));
 		break;
 	case OBJ_NATIVE:
-		printf("<native fn>");
+		output_write(out, "<native fn>", 11);
 		break;
+	case OBJ_ROPE: {
+		obj_string_t *s = flatten_rope(AS_ROPE(val));
+		output_write(out, s->chars, s->length);
+		break;
+	}
 	}
 }
 
@@ -38,9 +46,14 @@ static struct obj *allocate_object(size_t size, obj_type_t type)
 {
 	struct obj *obj = (struct obj *)reallocate(NULL, 0, size);
 	obj->type = type;
+	obj->is_marked = false;
+
+	obj->next = vm->objects; /* insert in front of list*/
+	vm->objects = obj;
 
-	obj->next = vm.objects; /* insert in front of list*/
-	vm.objects = obj;
+#ifdef DEBUG_LOG_GC
+	printf("%p allocate %zu for %d\n", (void *)obj, size, type);
+#endif
 
 	return obj;
 }
@@ -60,6 +73,7 @@ obj_function_t *new_function()
 	obj_function_t *func = ALLOCATE_OBJ(obj_function_t, OBJ_FUNCTION);
 
 	func->arity = 0;
+	func->max_stack = 0;
 	func->name = NULL;
 	init_chunk(&func->chunk);
 
@@ -72,8 +86,12 @@ static obj_string_t *allocate_string(char *chars, int length, uint32_t hash)
 	string->length = length;
 	string->chars = chars;
 	string->hash = hash;
+	string->borrowed = false;
 
-	table_set(&vm.strings, string, NIL_VAL); /* intern the string*/
+	/* growing the intern table may trigger a collection*/
+	push(OBJ(string));
+	table_set(&vm->strings, string, NIL_VAL); /* intern the string*/
+	pop();
 
 	return string;
 }
@@ -94,7 +112,7 @@ obj_string_t *take_string(char *chars, int len)
 	uint32_t hash = hash_string(chars, len);
 
 	obj_string_t *interned =
-		table_find_string(&vm.strings, chars, len, hash);
+		table_find_string(&vm->strings, chars, len, hash);
 
 	if (interned) {
 		FREE_ARRAY(char, chars, len + 1);
@@ -103,19 +121,108 @@ obj_string_t *take_string(char *chars, int len)
 	return allocate_string(chars, len, hash);
 }
 
+static char *copy_chars(const char *chars, int length)
+{
+	char *heap_chars = ALLOCATE(char, length + 1);
+	memcpy(heap_chars, chars, length);
+	heap_chars[length] = '\0';
+	return heap_chars;
+}
+
 obj_string_t *copy_string(char *chars, int length)
 {
 	uint32_t hash = hash_string(chars, length);
 
 	obj_string_t *interned =
-		table_find_string(&vm.strings, chars, length, hash);
+		table_find_string(&vm->strings, chars, length, hash);
+
+	if (interned) {
+		/* callers of copy_string may rely on the NUL, and names
+		 * outlive the script they came from*/
+		if (interned->borrowed) {
+			push(OBJ(interned));
+			interned->chars = copy_chars(interned->chars, length);
+			interned->borrowed = false;
+			pop();
+		}
+		return interned;
+	}
+
+	return allocate_string(copy_chars(chars, length), length, hash);
+}
+
+obj_string_t *borrow_string(const char *chars, int length)
+{
+	uint32_t hash = hash_string(chars, length);
+
+	obj_string_t *interned =
+		table_find_string(&vm->strings, chars, length, hash);
 
 	if (interned)
 		return interned;
 
-	char *heap_chars = ALLOCATE(char, length + 1);
-	memcpy(heap_chars, chars, length);
-	heap_chars[length] = '\0';
+	obj_string_t *s = allocate_string((char *)chars, length, hash);
+	s->borrowed = true;
+	return s;
+}
+
+obj_rope_t *new_rope(struct obj *left, struct obj *right, int length)
+{
+	obj_rope_t *rope = ALLOCATE_OBJ(obj_rope_t, OBJ_ROPE);
+	rope->length = length;
+	rope->left = left;
+	rope->right = right;
+	rope->flat = NULL;
+
+	return rope;
+}
+
+obj_string_t *flatten_rope(obj_rope_t *rope)
+{
+	if (rope->flat)
+		return rope->flat;
+
+	char *chars = ALLOCATE(char, rope->length + 1);
+
+	/* ropes built in a loop are as deep as the loop is long, so walk the
+	 * tree with an explicit stack rather than recursion*/
+	int capacity = 0;
+	int count = 0;
+	struct obj **stack = NULL;
+	int pos = 0;
+
+	struct obj *node = (struct obj *)rope;
+	for (;;) {
+		if (node->type == OBJ_ROPE && !((obj_rope_t *)node)->flat) {
+			obj_rope_t *r = (obj_rope_t *)node;
+			if (count + 1 > capacity) {
+				int old = capacity;
+				capacity = GROW_CAPACITY(old);
+				stack = GROW_ARRAY(stack, struct obj *, old,
+						   capacity);
+			}
+			stack[count++] = r->right;
+			node = r->left;
+			continue;
+		}
+
+		obj_string_t *s = node->type == OBJ_ROPE ?
+					  ((obj_rope_t *)node)->flat :
+					  (obj_string_t *)node;
+		memcpy(chars + pos, s->chars, s->length);
+		pos += s->length;
+
+		if (count == 0)
+			break;
+		node = stack[--count];
+	}
+	FREE_ARRAY(struct obj *, stack, capacity);
 
-	return allocate_string(heap_chars, length, hash);
-}
\ No newline at end of file
+	chars[rope->length] = '\0';
+	rope->flat = take_string(chars, rope->length);
+	/* the pieces are garbage now unless something else holds them*/
+	rope->left = NULL;
+	rope->right = NULL;
+
+	return rope->flat;
+}
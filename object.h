@@ -8,12 +8,14 @@ typedef enum {
 	OBJ_STRING,
 	OBJ_FUNCTION,
 	OBJ_NATIVE,
+	OBJ_ROPE,
 
 } obj_type_t;
 
 /*lox object: all lox objects inherit from this struct*/
 struct obj {
 	obj_type_t type;
+	bool is_marked; /* reached in the current gc cycle*/
 	struct obj *next;
 };
 
@@ -22,14 +24,34 @@ struct obj_string {
 	int length; /* string length */
 	char *chars; /* character array */
 	uint32_t hash; /* cache the hash of string objects for quick lookup*/
+	bool borrowed; /* chars point into a mapped source and, unlike owned
+			  ones, are not NUL-terminated*/
 };
 
 typedef struct obj_string obj_string_t;
 
+/* result of a string concatenation that hasn't been looked at yet. Nothing
+ * is copied, hashed or interned until the contents are needed; the rope is
+ * then flattened once and keeps the interned string*/
+struct obj_rope {
+	struct obj obj;
+	int length; /* total length of the concatenated string */
+	struct obj *left; /* obj_string_t or obj_rope_t, NULL once flattened */
+	struct obj *right;
+	obj_string_t *flat; /* the interned contents once flattened */
+};
+
+typedef struct obj_rope obj_rope_t;
+
+/* concatenations shorter than this are copied right away: a rope node costs
+ * more than copying a few bytes*/
+#define ROPE_MIN_LENGTH 64
+
 /* function object in lox*/
 struct obj_function {
 	struct obj obj; /*base class */
 	int arity; /* number of args */
+	int max_stack; /* stack slots a call needs, callee and args included*/
 	struct chunk chunk; /* bytecode chunk*/
 	obj_string_t *name; /* function name*/
 };
@@ -57,10 +79,19 @@ obj_native_t *new_native(native_fn_t function, int arity);
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
 #define AS_STRING(value) ((obj_string_t *)AS_OBJ(value))
 #define AS_CSTRING(value) (((obj_string_t *)AS_OBJ(value))->chars)
+#define IS_ROPE(value) is_obj_type(value, OBJ_ROPE)
+#define AS_ROPE(value) ((obj_rope_t *)AS_OBJ(value))
 
-void print_object(value_t val);
+void output_object(struct output *out, value_t val);
 obj_string_t *copy_string(char *chars, int length);
 obj_string_t *take_string(char *chars, int len);
+/* intern chars without copying them. They must stay put as long as the vm,
+ * i.e. lie in one of its mappings*/
+obj_string_t *borrow_string(const char *chars, int length);
+obj_rope_t *new_rope(struct obj *left, struct obj *right, int length);
+/* copy the rope's pieces into one interned string. The rope must be
+ * reachable by the collector while this runs*/
+obj_string_t *flatten_rope(obj_rope_t *rope);
 static inline bool is_obj_type(value_t value, obj_type_t t)
 {
 	return IS_OBJ(value) && AS_OBJ(value)->type == t;
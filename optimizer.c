@@ -0,0 +1,359 @@
+#include <string.h>
+#include "optimizer.h"
+#include "memory.h"
+#include "vm.h"
+
+/*
+ * The chunk is decoded into a list of instructions with jump targets turned
+ * into instruction indices. Rewrites change opcodes and mark instructions
+ * dead; the code is then re-encoded, with jumps to a dead instruction landing
+ * on the next live one.
+ *
+ * An instruction can only be merged into its predecessor when no jump lands
+ * on it, so every rule checks jumps_in first. Only live instructions keep a
+ * count: a dead one hands its jumps on to the next live one, see kill.
+ */
+
+struct insn {
+	int line;
+	uint8_t op;
+	uint8_t operands[4]; /* operand bytes, a jump's offset excepted*/
+	int target; /* index of the instruction a jump lands on, or -1*/
+	int jumps_in; /* number of jumps landing here*/
+	bool dead;
+};
+
+static bool is_jump(uint8_t op)
+{
+	switch (op) {
+	case OP_JUMP:
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP_IF_FALSE_POP:
+	case OP_LESS_JUMP:
+	case OP_LESS_LOCAL_CONST_JUMP:
+	case OP_LOOP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* the comparison computing the opposite result, or -1. Each pair is an exact
+ * negation, NaN included: >= is !(a < b) and <= is !(a > b)*/
+static int negated_compare(uint8_t op)
+{
+	switch (op) {
+	case OP_EQUAL:
+		return OP_NOT_EQUAL;
+	case OP_NOT_EQUAL:
+		return OP_EQUAL;
+	case OP_LESS:
+		return OP_GREATER_EQUAL;
+	case OP_GREATER_EQUAL:
+		return OP_LESS;
+	case OP_GREATER:
+		return OP_LESS_EQUAL;
+	case OP_LESS_EQUAL:
+		return OP_GREATER;
+	default:
+		return -1;
+	}
+}
+
+static int next_live(struct insn *insns, int n, int i)
+{
+	do {
+		i++;
+	} while (i < n && insns[i].dead);
+	return i;
+}
+
+static int prev_live(struct insn *insns, int i)
+{
+	do {
+		i--;
+	} while (i >= 0 && insns[i].dead);
+	return i;
+}
+
+/* jumps landing on a dead instruction land on the next live one, and so
+ * count there. A jump being killed still counts where it lands until the
+ * caller takes it off or hands it to the instruction replacing it*/
+static void kill(struct insn *insns, int n, int i)
+{
+	int next = next_live(insns, n, i);
+	insns[i].dead = true;
+	insns[next].jumps_in += insns[i].jumps_in;
+	insns[i].jumps_in = 0;
+}
+
+/* OP_JUMP_IF_FALSE leaves the condition on the stack, so if and while pop
+ * it once at the start of each path:
+ *
+ *	OP_JUMP_IF_FALSE else      =>   OP_JUMP_IF_FALSE_POP else
+ *	OP_POP                          ...
+ *	...                             OP_JUMP end
+ *	OP_JUMP end                  else:
+ *   else:                              ...
+ *	OP_POP
+ *
+ * The else side is only ours if nothing else jumps or falls into it*/
+static void fuse_conditional_pops(struct insn *insns, int n)
+{
+	for (int i = 0; i < n; i++) {
+		struct insn *jump = &insns[i];
+		if (jump->op != OP_JUMP_IF_FALSE || jump->target >= n)
+			continue;
+
+		int j = next_live(insns, n, i);
+		int t = jump->target;
+		int before_t = prev_live(insns, t);
+
+		if (j >= n || insns[j].op != OP_POP || insns[j].jumps_in ||
+		    insns[t].op != OP_POP || insns[t].jumps_in != 1 ||
+		    before_t < 0)
+			continue;
+
+		uint8_t op = insns[before_t].op;
+		if (op != OP_JUMP && op != OP_LOOP && op != OP_RETURN)
+			continue;
+
+		jump->op = OP_JUMP_IF_FALSE_POP;
+		kill(insns, n, j);
+		kill(insns, n, t);
+	}
+}
+
+/* fold OP_NOT into the comparison before it, then a comparison followed by
+ * a conditional jump into a single compare-and-branch*/
+static void fuse_compares(struct insn *insns, int n)
+{
+	for (int i = 0; i < n; i++) {
+		struct insn *in = &insns[i];
+		if (in->dead)
+			continue;
+
+		int j = next_live(insns, n, i);
+		while (j < n && insns[j].op == OP_NOT && !insns[j].jumps_in &&
+		       negated_compare(in->op) != -1) {
+			in->op = negated_compare(in->op);
+			kill(insns, n, j);
+			j = next_live(insns, n, j);
+		}
+
+		if (j < n && in->op == OP_LESS &&
+		    insns[j].op == OP_JUMP_IF_FALSE_POP && !insns[j].jumps_in) {
+			in->op = OP_LESS_JUMP;
+			in->target = insns[j].target;
+			kill(insns, n, j);
+		}
+	}
+}
+
+/* an unconditional jump to the instruction after it, which is what an if
+ * without an else leaves behind once its pops are gone*/
+static void drop_empty_jumps(struct insn *insns, int n)
+{
+	for (int i = 0; i < n; i++) {
+		struct insn *in = &insns[i];
+		if (in->dead || in->op != OP_JUMP)
+			continue;
+
+		int t = in->target;
+		if (t < n && insns[t].dead)
+			t = next_live(insns, n, t);
+		if (t == next_live(insns, n, i)) {
+			insns[t].jumps_in--;
+			kill(insns, n, i);
+		}
+	}
+}
+
+/* instruction after the live instruction i, if nothing jumps to it*/
+static struct insn *fusable_next(struct insn *insns, int n, int i)
+{
+	int j = next_live(insns, n, i);
+	if (j >= n || insns[j].jumps_in)
+		return NULL;
+	return &insns[j];
+}
+
+/* superinstructions for the most frequent sequences in the benchmarks, see
+ * DEBUG_PROFILE_OPCODES. Constants are only fused in their one byte form*/
+static void fuse_superinstructions(struct insn *insns, int n)
+{
+	for (int i = 0; i < n; i++) {
+		struct insn *in = &insns[i];
+		if (in->dead)
+			continue;
+
+		struct insn *second = fusable_next(insns, n, i);
+		if (!second)
+			continue;
+		struct insn *third = fusable_next(insns, n, second - insns);
+
+		switch (in->op) {
+		case OP_GET_LOCAL:
+			if (!third)
+				break;
+
+			if (second->op == OP_GET_LOCAL && third->op == OP_ADD) {
+				in->op = OP_ADD_LOCALS;
+				in->operands[1] = second->operands[0];
+			} else if (second->op == OP_CONSTANT &&
+				   third->op == OP_ADD) {
+				in->op = OP_ADD_LOCAL_CONST;
+				in->operands[1] = second->operands[0];
+			} else if (second->op == OP_CONSTANT &&
+				   third->op == OP_SUB) {
+				in->op = OP_SUB_LOCAL_CONST;
+				in->operands[1] = second->operands[0];
+			} else if (second->op == OP_CONSTANT &&
+				   third->op == OP_LESS_JUMP) {
+				in->op = OP_LESS_LOCAL_CONST_JUMP;
+				in->operands[1] = second->operands[0];
+				in->target = third->target;
+			} else {
+				break;
+			}
+
+			/* report errors on the line of the operator*/
+			in->line = third->line;
+			kill(insns, n, second - insns);
+			kill(insns, n, third - insns);
+			break;
+
+		case OP_SET_LOCAL:
+		case OP_SET_GLOBAL:
+			/* the repl prints the value an OP_POPX discards*/
+			if (second->op != OP_POP &&
+			    (second->op != OP_POPX || vm->repl_mode))
+				break;
+
+			in->op = in->op == OP_SET_LOCAL ? OP_SET_LOCAL_POP :
+							  OP_SET_GLOBAL_POP;
+			kill(insns, n, second - insns);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+static void encode(struct chunk *c, struct insn *insns, int n)
+{
+	int *offsets = ALLOCATE(int, n + 1);
+	int size = 0;
+
+	/* a dead instruction gets the offset of the next live one*/
+	for (int i = 0; i <= n; i++) {
+		offsets[i] = size;
+		if (i < n && !insns[i].dead)
+			size += instruction_size(insns[i].op);
+	}
+
+	struct chunk out;
+	init_chunk(&out);
+
+	for (int i = 0; i < n; i++) {
+		struct insn *in = &insns[i];
+		if (in->dead)
+			continue;
+
+		int size = instruction_size(in->op);
+		int operand_count = is_jump(in->op) ? size - 3 : size - 1;
+
+		write_chunk(&out, in->op, in->line);
+		for (int k = 0; k < operand_count; k++)
+			write_chunk(&out, in->operands[k], in->line);
+
+		if (is_jump(in->op)) {
+			/* offsets count from the end of the instruction*/
+			int next = offsets[i] + size;
+			int jmp = in->op == OP_LOOP ?
+					  next - offsets[in->target] :
+					  offsets[in->target] - next;
+			write_chunk(&out, (jmp >> 8) & 0xff, in->line);
+			write_chunk(&out, jmp & 0xff, in->line);
+		}
+	}
+
+	FREE_ARRAY(int, offsets, n + 1);
+	FREE_ARRAY(uint8_t, c->code, c->capacity);
+	FREE_ARRAY(struct line_start, c->lines, c->line_capacity);
+
+	c->code = out.code;
+	c->count = out.count;
+	c->capacity = out.capacity;
+	c->lines = out.lines;
+	c->line_count = out.line_count;
+	c->line_capacity = out.line_capacity;
+}
+
+void optimize_chunk(struct chunk *c)
+{
+	int count = c->count;
+	int *index = ALLOCATE(int, count + 1); /* instruction at each offset*/
+	int *lines = ALLOCATE(int, count + 1); /* line of each byte*/
+	/* one spare entry stands for the end of the code*/
+	struct insn *insns = ALLOCATE(struct insn, count + 1);
+	int n = 0;
+
+	for (int run = 0; run < c->line_count; run++) {
+		int end = run + 1 < c->line_count ? c->lines[run + 1].offset :
+						     count;
+		for (int offset = c->lines[run].offset; offset < end; offset++)
+			lines[offset] = c->lines[run].line;
+	}
+
+	for (int offset = 0; offset <= count; offset++)
+		index[offset] = -1;
+
+	for (int offset = 0; offset < count;
+	     offset += instruction_size(c->code[offset])) {
+		struct insn *in = &insns[n];
+		in->line = lines[offset];
+		in->op = c->code[offset];
+		memset(in->operands, 0, sizeof(in->operands));
+		memcpy(in->operands, &c->code[offset + 1],
+		       instruction_size(in->op) - 1);
+		in->target = -1;
+		in->jumps_in = 0;
+		in->dead = false;
+		index[offset] = n++;
+	}
+	index[count] = n;
+	insns[n].jumps_in = 0;
+	insns[n].dead = false;
+
+	for (int offset = 0; offset < count;
+	     offset += instruction_size(c->code[offset])) {
+		struct insn *in = &insns[index[offset]];
+		int size = instruction_size(in->op);
+		if (!is_jump(in->op))
+			continue;
+
+		uint8_t *operand = &c->code[offset + size - 2];
+		int jmp = operand[0] << 8 | operand[1];
+		int to = in->op == OP_LOOP ? offset + size - jmp :
+					     offset + size + jmp;
+
+		/* the compiler only jumps to instruction boundaries*/
+		if (to < 0 || to > count || index[to] == -1)
+			goto out;
+		in->target = index[to];
+		insns[in->target].jumps_in++;
+	}
+
+	fuse_conditional_pops(insns, n);
+	fuse_compares(insns, n);
+	drop_empty_jumps(insns, n);
+	fuse_superinstructions(insns, n);
+	encode(c, insns, n);
+
+out:
+	FREE_ARRAY(int, index, count + 1);
+	FREE_ARRAY(int, lines, count + 1);
+	FREE_ARRAY(struct insn, insns, count + 1);
+}
@@ -0,0 +1,12 @@
+#ifndef CLOX_OPTIMIZER_H
+#define CLOX_OPTIMIZER_H
+
+#include "chunk.h"
+#include "common.h"
+
+/* peephole pass over a finished chunk. Fuses common instruction sequences
+ * into single opcodes and drops what they make redundant, rewriting jump
+ * offsets and the line table to match*/
+void optimize_chunk(struct chunk *c);
+
+#endif
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dtoa.h"
+#include "output.h"
+
+void init_output(struct output *o, FILE *file)
+{
+	o->file = file;
+	o->buf = NULL;
+	o->length = 0;
+	o->capacity = 0;
+	o->policy = isatty(fileno(file)) ? FLUSH_LINE : FLUSH_BLOCK;
+#ifdef DEBUG_TRACE_EXECUTION
+	/* keep the output in step with the trace*/
+	o->policy = FLUSH_LINE;
+#endif
+	o->g_format = false;
+}
+
+void free_output(struct output *o)
+{
+	flush_output(o);
+	free(o->buf);
+	o->buf = NULL;
+	o->capacity = 0;
+}
+
+void flush_output(struct output *o)
+{
+	if (o->length) {
+		fwrite(o->buf, 1, o->length, o->file);
+		o->length = 0;
+	}
+	fflush(o->file);
+}
+
+/* make room for needed more bytes. Outside FLUSH_EXIT that means writing
+ * out what is there once the buffer has reached OUTPUT_BLOCK*/
+void output_grow(struct output *o, size_t needed)
+{
+	if (o->policy != FLUSH_EXIT && o->capacity >= OUTPUT_BLOCK) {
+		flush_output(o);
+		if (needed <= o->capacity)
+			return;
+	}
+
+	size_t capacity = o->capacity ? o->capacity : OUTPUT_BLOCK;
+	while (capacity < o->length + needed)
+		capacity *= 2;
+
+	o->buf = realloc(o->buf, capacity);
+	if (!o->buf) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+	o->capacity = capacity;
+}
+
+void output_write(struct output *o, const char *s, size_t length)
+{
+	/* the buffer isn't allocated until something goes in it*/
+	if (!length)
+		return;
+
+	/* a string as long as a block is not worth copying*/
+	if (length >= OUTPUT_BLOCK && o->policy != FLUSH_EXIT) {
+		flush_output(o);
+		fwrite(s, 1, length, o->file);
+		if (o->policy == FLUSH_LINE)
+			fflush(o->file);
+		return;
+	}
+
+	if (o->capacity - o->length < length)
+		output_grow(o, length);
+	memcpy(o->buf + o->length, s, length);
+	o->length += length;
+	if (o->policy == FLUSH_LINE && memchr(s, '\n', length))
+		flush_output(o);
+}
+
+void output_number(struct output *o, double d)
+{
+	if (o->capacity - o->length < NUMBER_BUFFER_SIZE)
+		output_grow(o, NUMBER_BUFFER_SIZE);
+
+	char *p = o->buf + o->length;
+	o->length += o->g_format ? format_number_g(d, p) : format_number(d, p);
+}
@@ -0,0 +1,46 @@
+#ifndef CLOX_OUTPUT_H
+#define CLOX_OUTPUT_H
+
+#include <stdio.h>
+#include "common.h"
+
+/* bytes gathered before a block-buffered output is written out*/
+#define OUTPUT_BLOCK 16384
+
+enum flush_policy {
+	FLUSH_LINE, /* after every newline, for terminals */
+	FLUSH_BLOCK, /* whenever OUTPUT_BLOCK bytes have gathered */
+	FLUSH_EXIT, /* only when flushed explicitly or freed */
+};
+
+/* what the vm prints is gathered here and handed to file in large writes.
+ * Errors go to another stream, so the vm flushes this before reporting one,
+ * and before reading input*/
+struct output {
+	FILE *file;
+	char *buf;
+	size_t length;
+	size_t capacity;
+	enum flush_policy policy;
+	bool g_format; /* numbers exactly as printf's %g writes them */
+};
+
+/* line-buffered if file is a terminal, block-buffered otherwise*/
+void init_output(struct output *o, FILE *file);
+/* flush what is left and release the buffer*/
+void free_output(struct output *o);
+void flush_output(struct output *o);
+void output_write(struct output *o, const char *s, size_t length);
+void output_number(struct output *o, double d);
+void output_grow(struct output *o, size_t needed);
+
+static inline void output_char(struct output *o, char c)
+{
+	if (o->length == o->capacity)
+		output_grow(o, 1);
+	o->buf[o->length++] = c;
+	if (c == '\n' && o->policy == FLUSH_LINE)
+		flush_output(o);
+}
+
+#endif
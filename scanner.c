@@ -2,7 +2,11 @@
 #include <string.h>
 #include "scanner.h"
 
-struct scanner scanner;
+#ifdef SIMD_SCANNER
+#include <emmintrin.h>
+#endif
+
+_Thread_local struct scanner scanner;
 
 void init_scanner(const char *src)
 {
@@ -78,6 +82,117 @@ static bool is_alpha(char c)
 	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_');
 }
 
+#ifdef SIMD_SCANNER
+
+/*
+ * Each classifier below flags the bytes of a 16 byte block that end a run:
+ * bit i of the result stands for byte i. Every one of them flags the NUL
+ * terminator, so a scan never goes past the block holding it.
+ */
+#define BYTES(c) _mm_set1_epi8(c)
+#define EQ(b, c) _mm_cmpeq_epi8(b, BYTES(c))
+
+/* c in [lo, lo + n), as a signed compare after moving lo down to -128*/
+static inline __m128i in_range(__m128i b, char lo, int n)
+{
+	__m128i shifted = _mm_add_epi8(b, BYTES((char)(-128 - lo)));
+	return _mm_cmplt_epi8(shifted, BYTES((char)(-128 + n)));
+}
+
+static inline unsigned newlines(__m128i b)
+{
+	return _mm_movemask_epi8(EQ(b, '\n'));
+}
+
+static inline unsigned space_stops(__m128i b)
+{
+	__m128i space = _mm_or_si128(_mm_or_si128(EQ(b, ' '), EQ(b, '\t')),
+				     _mm_or_si128(EQ(b, '\r'), EQ(b, '\n')));
+	return ~_mm_movemask_epi8(space) & 0xffff;
+}
+
+static inline unsigned comment_stops(__m128i b)
+{
+	return _mm_movemask_epi8(_mm_or_si128(EQ(b, '\n'), EQ(b, '\0')));
+}
+
+static inline unsigned string_stops(__m128i b)
+{
+	return _mm_movemask_epi8(_mm_or_si128(EQ(b, '"'), EQ(b, '\0')));
+}
+
+static inline unsigned identifier_stops(__m128i b)
+{
+	/* setting 0x20 folds upper case onto lower case*/
+	__m128i letter = in_range(_mm_or_si128(b, BYTES(0x20)), 'a', 26);
+	__m128i digit = in_range(b, '0', 10);
+	__m128i word = _mm_or_si128(_mm_or_si128(letter, digit), EQ(b, '_'));
+	return ~_mm_movemask_epi8(word) & 0xffff;
+}
+
+#undef EQ
+#undef BYTES
+
+/* the first byte from p on that stops() flags, adding the newlines passed
+ * on the way to the line count if count_lines is set. This is inlined with
+ * constant arguments, so the indirect call and the test go away*/
+static inline const char *scan_to(const char *p, unsigned (*stops)(__m128i),
+				  bool count_lines)
+{
+	uintptr_t offset = (uintptr_t)p & 15;
+	const char *block = p - offset;
+	unsigned head = 0xffffu << offset; /* drops the bytes before p*/
+
+	for (;;) {
+		__m128i b = _mm_load_si128((const __m128i *)block);
+		unsigned stop = stops(b) & head;
+		unsigned nl = count_lines ? newlines(b) & head : 0;
+
+		if (stop) {
+			/* only the newlines before the first stop count*/
+			nl &= (stop & -stop) - 1;
+			if (nl)
+				scanner.line += __builtin_popcount(nl);
+			return block + __builtin_ctz(stop);
+		}
+		if (nl)
+			scanner.line += __builtin_popcount(nl);
+		block += 16;
+		head = 0xffff;
+	}
+}
+
+static void skip_white_space_and_comments()
+{
+	for (;;) {
+		switch (peek()) {
+		case ' ':
+			/* a lone space between tokens is the common case*/
+			if (scanner.current[1] != ' ') {
+				advance();
+				break;
+			}
+			/* fallthrough*/
+		case '\n':
+		case '\t':
+		case '\r':
+			scanner.current = scan_to(scanner.current, space_stops, true);
+			break;
+		case '/':
+			if (peek_next() != '/')
+				return;
+			/* stops on the newline, which the case above counts*/
+			scanner.current =
+				scan_to(scanner.current, comment_stops, false);
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+#else
+
 static void skip_white_space_and_comments()
 {
 	for (;;) {
@@ -94,8 +209,12 @@ static void skip_white_space_and_comments()
 			break;
 		case '/':
 			if (peek_next() == '/') {
-				while (!is_at_end() && peek() != '\n')
-					advance();
+				/* a local cursor saves reloading scanner.current
+				 * after every store through it*/
+				const char *p = scanner.current;
+				while (*p != '\n' && *p != '\0')
+					p++;
+				scanner.current = p;
 			} else {
 				return;
 			}
@@ -106,13 +225,21 @@ static void skip_white_space_and_comments()
 	}
 }
 
+#endif
+
 static struct token string()
 {
-	while (!is_at_end() && peek() != '"') {
-		if (peek() == '\n')
+#ifdef SIMD_SCANNER
+	scanner.current = scan_to(scanner.current, string_stops, true);
+#else
+	const char *p = scanner.current;
+	while (*p != '"' && *p != '\0') {
+		if (*p == '\n')
 			scanner.line++;
-		advance();
-	};
+		p++;
+	}
+	scanner.current = p;
+#endif
 
 	if (is_at_end())
 		return error_token("Unterminated string.");
@@ -135,73 +262,68 @@ static struct token number()
 	return make_token(TOKEN_NUMBER);
 }
 
-static token_type_t check_keyword(int start, int len, const char *rest,
-				  token_type_t type)
-{
-	int r = memcmp(scanner.start + start, rest, len);
-	if ((scanner.current - scanner.start) == (start + len) && r == 0)
-		return type;
-
-	return TOKEN_IDENTIFIER;
-}
+/*
+ * Keywords are looked up in a table indexed by a hash of their first two
+ * characters and length. The multipliers were picked so that no two
+ * keywords collide, which leaves one comparison per candidate identifier.
+ */
+#define KEYWORD_HASH(c0, c1, len) (((c0)*4 + (c1)*3 + (len)) & 31)
+#define KEYWORD(c0, c1, name, type) \
+	[KEYWORD_HASH(c0, c1, sizeof(name) - 1)] = { name, sizeof(name) - 1, type }
+
+static const struct keyword {
+	const char *name;
+	int length;
+	token_type_t type;
+} keywords[32] = {
+	KEYWORD('a', 'n', "and", TOKEN_AND),
+	KEYWORD('c', 'l', "class", TOKEN_CLASS),
+	KEYWORD('e', 'l', "else", TOKEN_ELSE),
+	KEYWORD('f', 'a', "false", TOKEN_FALSE),
+	KEYWORD('f', 'o', "for", TOKEN_FOR),
+	KEYWORD('f', 'u', "fun", TOKEN_FUN),
+	KEYWORD('i', 'f', "if", TOKEN_IF),
+	KEYWORD('n', 'i', "nil", TOKEN_NIL),
+	KEYWORD('o', 'r', "or", TOKEN_OR),
+	KEYWORD('p', 'r', "print", TOKEN_PRINT),
+	KEYWORD('r', 'e', "return", TOKEN_RETURN),
+	KEYWORD('s', 'u', "super", TOKEN_SUPER),
+	KEYWORD('t', 'h', "this", TOKEN_THIS),
+	KEYWORD('t', 'r', "true", TOKEN_TRUE),
+	KEYWORD('v', 'a', "var", TOKEN_VAR),
+	KEYWORD('w', 'h', "while", TOKEN_WHILE),
+};
+
+#undef KEYWORD
 
 static token_type_t identifier_type()
 {
-	switch (scanner.start[0]) {
-	case 'a':
-		return check_keyword(1, 2, "nd", TOKEN_AND);
-	case 'c':
-		return check_keyword(1, 4, "lass", TOKEN_CLASS);
-	case 'e':
-		return check_keyword(1, 3, "lse", TOKEN_ELSE);
-	case 'i':
-		return check_keyword(1, 1, "f", TOKEN_IF);
-	case 'n':
-		return check_keyword(1, 2, "il", TOKEN_NIL);
-	case 'o':
-		return check_keyword(1, 1, "r", TOKEN_OR);
-	case 'p':
-		return check_keyword(1, 4, "rint", TOKEN_PRINT);
-	case 'r':
-		return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-	case 's':
-		return check_keyword(1, 4, "uper", TOKEN_SUPER);
-	case 'v':
-		return check_keyword(1, 2, "ar", TOKEN_VAR);
-	case 'w':
-		return check_keyword(1, 4, "hile", TOKEN_WHILE);
-
-	case 'f':
-		if (scanner.current - scanner.start > 1) {
-			switch (scanner.start[1]) {
-			case 'a':
-				return check_keyword(2, 3, "lse", TOKEN_FALSE);
-			case 'u':
-				return check_keyword(2, 1, "n", TOKEN_FUN);
-			case 'o':
-				return check_keyword(2, 1, "r", TOKEN_FOR);
-			}
-		}
-		break;
-	case 't':
-		if (scanner.current - scanner.start > 1) {
-			switch (scanner.start[1]) {
-			case 'r':
-				return check_keyword(2, 2, "ue", TOKEN_TRUE);
-			case 'h':
-				return check_keyword(2, 2, "is", TOKEN_THIS);
-			}
-		}
-		break;
+	int len = scanner.current - scanner.start;
+	if (len < 2 || len > 6)
+		return TOKEN_IDENTIFIER;
+
+	const struct keyword *k =
+		&keywords[KEYWORD_HASH(scanner.start[0], scanner.start[1], len)];
+	if (k->length != len)
+		return TOKEN_IDENTIFIER;
+	/* too short for a call to memcmp to pay*/
+	for (int i = 0; i < len; i++) {
+		if (scanner.start[i] != k->name[i])
+			return TOKEN_IDENTIFIER;
 	}
-
-	return TOKEN_IDENTIFIER;
+	return k->type;
 }
 
 static struct token identifier()
 {
-	while (is_alpha(peek()) || is_digit(peek()))
-		advance();
+#ifdef SIMD_SCANNER
+	scanner.current = scan_to(scanner.current, identifier_stops, false);
+#else
+	const char *p = scanner.current;
+	while (is_alpha(*p) || is_digit(*p))
+		p++;
+	scanner.current = p;
+#endif
 
 	return make_token(identifier_type());
 }
@@ -0,0 +1,139 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.h"
+#include "vm.h"
+
+/* what a pipe is read in to start with*/
+#define SOURCE_BLOCK 65536
+
+void add_mapping(struct vm *v, void *base, size_t size)
+{
+	struct mapped_file *m = malloc(sizeof(struct mapped_file));
+	if (!m) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+	m->base = base;
+	m->size = size;
+	m->next = v->mappings;
+	v->mappings = m;
+}
+
+bool is_mapped(const void *p)
+{
+	for (struct mapped_file *m = vm->mappings; m; m = m->next) {
+		if ((const char *)p >= (const char *)m->base &&
+		    (const char *)p < (const char *)m->base + m->size)
+			return true;
+	}
+	return false;
+}
+
+void unmap_files()
+{
+	struct mapped_file *m = vm->mappings;
+	while (m) {
+		struct mapped_file *next = m->next;
+		munmap(m->base, m->size);
+		free(m);
+		m = next;
+	}
+	vm->mappings = NULL;
+}
+
+/* the file goes over the start of a zeroed anonymous region one byte
+ * longer than it. Past the end of the file the last page reads as zeros
+ * either way, so the text is NUL-terminated without being copied*/
+static bool map_source(struct vm *v, int fd, size_t size, struct source *s)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t span = (size + page) / page * page;
+
+	char *base = mmap(NULL, span, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+			  -1, 0);
+	if (base == MAP_FAILED)
+		return false;
+	if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+	    MAP_FAILED) {
+		munmap(base, span);
+		return false;
+	}
+
+	add_mapping(v, base, span);
+	s->chars = base;
+	s->length = size;
+	s->buf = NULL;
+	return true;
+}
+
+/* for pipes and anything else that can't be mapped*/
+static bool read_source(int fd, struct source *s)
+{
+	size_t capacity = SOURCE_BLOCK;
+	size_t length = 0;
+	char *buf = malloc(capacity);
+	if (!buf)
+		return false;
+
+	for (;;) {
+		/* one byte is kept for the NUL*/
+		if (length + 1 == capacity) {
+			capacity *= 2;
+			char *grown = realloc(buf, capacity);
+			if (!grown) {
+				free(buf);
+				return false;
+			}
+			buf = grown;
+		}
+
+		ssize_t n = read(fd, buf + length, capacity - length - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			free(buf);
+			return false;
+		}
+		if (n == 0)
+			break;
+		length += n;
+	}
+
+	buf[length] = '\0';
+	s->chars = buf;
+	s->length = length;
+	s->buf = buf;
+	return true;
+}
+
+bool load_source(struct vm *v, const char *path, struct source *s)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+	if (ok && S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    map_source(v, fd, st.st_size, s)) {
+		close(fd);
+		return true;
+	}
+
+	ok = ok && read_source(fd, s);
+	int saved = errno;
+	close(fd);
+	errno = saved;
+	return ok;
+}
+
+void free_source(struct source *s)
+{
+	free(s->buf);
+	s->buf = NULL;
+	s->chars = NULL;
+}
@@ -0,0 +1,37 @@
+#ifndef CLOX_SOURCE_H
+#define CLOX_SOURCE_H
+
+#include <stdio.h>
+#include "common.h"
+
+struct vm;
+
+/* a file mapped into memory for a vm: a bytecode cache or a script's
+ * source. Code and strings may point into the mapping, so it stays mapped
+ * until vm_reset or vm_free*/
+struct mapped_file {
+	void *base;
+	size_t size;
+	struct mapped_file *next;
+};
+
+void add_mapping(struct vm *v, void *base, size_t size);
+/* whether p points into one of the vm's mappings*/
+bool is_mapped(const void *p);
+void unmap_files();
+
+/* a script's text, always followed by a NUL. A regular file is mapped
+ * read-only for v and read in place, anything else (a pipe, a terminal) is
+ * read into a buffer as it arrives*/
+struct source {
+	const char *chars;
+	size_t length;
+	char *buf; /* NULL when mapped */
+};
+
+/* false, with errno set, if path can't be read*/
+bool load_source(struct vm *v, const char *path, struct source *s);
+/* a mapping is left to the vm, only a buffer is freed here*/
+void free_source(struct source *s);
+
+#endif
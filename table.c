@@ -158,3 +158,21 @@ bool table_delete(struct table *t, obj_string_t *key)
 
 	return true;
 }
+
+void table_remove_white(struct table *t)
+{
+	for (int i = 0; i < t->capacity; ++i) {
+		struct entry *e = &t->entries[i];
+		if (e->key && !e->key->obj.is_marked)
+			table_delete(t, e->key);
+	}
+}
+
+void mark_table(struct table *t)
+{
+	for (int i = 0; i < t->capacity; ++i) {
+		struct entry *e = &t->entries[i];
+		mark_object((obj_t *)e->key);
+		mark_value(e->value);
+	}
+}
@@ -25,4 +25,7 @@ bool table_delete(struct table *t, obj_string_t *key);
 void table_add_all(struct table *from, struct table *to);
 obj_string_t *table_find_string(struct table *t, const char *chars, int length,
 				uint32_t hash);
+/* delete entries whose keys were not marked by the collector*/
+void table_remove_white(struct table *t);
+void mark_table(struct table *t);
 #endif
\ No newline at end of file
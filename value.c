@@ -2,9 +2,16 @@
 #include "object.h"
 #include "value.h"
 #include "memory.h"
+#include "output.h"
 
 bool values_equal(value_t a, value_t b)
 {
+#ifdef NAN_BOXING
+	/* compare numbers as doubles so that NaN != NaN*/
+	if (IS_NUMBER(a) && IS_NUMBER(b))
+		return AS_NUMBER(a) == AS_NUMBER(b);
+	return a == b;
+#else
 	if (a.type != b.type)
 		return false;
 	switch (a.type) {
@@ -21,6 +28,40 @@ bool values_equal(value_t a, value_t b)
 		 * reaching end of non-void fn*/
 		return false;
 	}
+#endif
+}
+
+bool values_identical(value_t a, value_t b)
+{
+#ifdef NAN_BOXING
+	return a == b;
+#else
+	if (a.type != b.type)
+		return false;
+	if (IS_NUMBER(a))
+		return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+	return values_equal(a, b);
+#endif
+}
+
+uint32_t hash_value(value_t v)
+{
+	uint64_t bits;
+#ifdef NAN_BOXING
+	bits = v;
+#else
+	if (IS_NUMBER(v))
+		memcpy(&bits, &v.as.number, sizeof(double));
+	else if (IS_OBJ(v))
+		bits = (uint64_t)(uintptr_t)AS_OBJ(v);
+	else
+		bits = (uint64_t)v.type << 1 | (IS_BOOL(v) && AS_BOOL(v));
+#endif
+	/* fold and mix the 64 bits (murmur3 finalizer)*/
+	bits ^= bits >> 33;
+	bits *= 0xff51afd7ed558ccdULL;
+	bits ^= bits >> 33;
+	return (uint32_t)bits;
 }
 
 void init_value_array(struct value_array *v)
@@ -53,20 +94,27 @@ void undo_previous_write(struct value_array *v)
 	v->count--;
 }
 
-void print_value(value_t val)
+void output_value(struct output *out, value_t val)
 {
-	switch (val.type) {
-	case VAL_BOOL:
-		printf("%s", AS_BOOL(val) ? "true" : "false");
-		break;
-	case VAL_NUMBER:
-		printf("%g", AS_NUMBER(val));
-		break;
-	case VAL_NIL:
-		printf("%s", "nil");
-		break;
-	case VAL_OBJECT:
-		print_object(val);
-		break;
+	if (IS_BOOL(val)) {
+		if (AS_BOOL(val))
+			output_write(out, "true", 4);
+		else
+			output_write(out, "false", 5);
+	} else if (IS_NUMBER(val)) {
+		output_number(out, AS_NUMBER(val));
+	} else if (IS_NIL(val)) {
+		output_write(out, "nil", 3);
+	} else if (IS_OBJ(val)) {
+		output_object(out, val);
 	}
 }
+
+void print_value(value_t val)
+{
+	struct output out;
+	init_output(&out, stdout);
+	out.policy = FLUSH_EXIT;
+	output_value(&out, val);
+	free_output(&out);
+}
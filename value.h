@@ -1,12 +1,67 @@
 #ifndef CLOX_VALUE
 #define CLOX_VALUE
 
+#include <stdio.h>
+#include <string.h>
+
 #include "common.h"
 
 struct chunk;
+struct output;
 typedef struct obj obj_t;
 typedef struct obj_string obj_string_t;
 
+#ifdef NAN_BOXING
+
+/*
+ * A value is a 64-bit word. Any bit pattern that is not a quiet NaN is a
+ * double. Quiet NaNs carry either a singleton tag in the low bits (nil, true,
+ * false) or, with the sign bit set, an object pointer in the low 48 bits.
+ * Hardware NaNs (0x7ff8... or 0xfff8...) do not have the extra QNAN bit set,
+ * so they are still read back as doubles.
+ */
+typedef uint64_t value_t;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value)&QNAN) != QNAN)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_num(value)
+#define AS_OBJ(value) ((obj_t *)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define FALSE_VAL ((value_t)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((value_t)(uint64_t)(QNAN | TAG_TRUE))
+#define BOOL(value) ((value) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL ((value_t)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER(value) num_to_value(value)
+#define OBJ(obj) (value_t)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+/* type-pun through memcpy; compilers reduce this to a register move*/
+static inline double value_to_num(value_t value)
+{
+	double num;
+	memcpy(&num, &value, sizeof(value_t));
+	return num;
+}
+
+static inline value_t num_to_value(double num)
+{
+	value_t value;
+	memcpy(&value, &num, sizeof(double));
+	return value;
+}
+
+#else
+
 typedef enum {
 	VAL_BOOL,
 	VAL_NIL,
@@ -36,22 +91,37 @@ struct value_t {
 #define BOOL(value) ((struct value_t){ VAL_BOOL, { .boolean = value } })
 #define NIL_VAL ((struct value_t){ VAL_NIL, { .number = 0 } })
 #define NUMBER(value) ((struct value_t){ VAL_NUMBER, { .number = value } })
-#define OBJ(obj) ((struct value_t){ VAL_OBJECT, { .object = (obj_t *)obj } })
+#define OBJ(obj) \
+	((struct value_t){ VAL_OBJECT, { .object = (obj_t *)(obj) } })
 
 
 typedef struct value_t value_t;
 
+#endif
+
 struct value_array {
 	int count;
 	int capacity;
 	value_t *values;
 };
 
+/* nil and false are falsy, everything else is truthy*/
+static inline bool is_falsy(value_t v)
+{
+	return IS_NIL(v) || (IS_BOOL(v) && !AS_BOOL(v));
+}
+
 bool values_equal(value_t a, value_t b);
+/* bitwise identity: unlike values_equal, 0 and -0 differ and NaN matches
+ * itself*/
+bool values_identical(value_t a, value_t b);
+uint32_t hash_value(value_t v);
 void init_value_array(struct value_array *v);
 void free_value_array(struct value_array *v);
 void write_value_array(struct value_array *v, value_t val);
 void undo_previous_write(struct value_array *v);
+void output_value(struct output *out, value_t val);
+/* print to stdout, for the debugging output*/
 void print_value(value_t val);
 
 #endif
\ No newline at end of file
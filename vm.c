@@ -10,7 +10,7 @@
 #include "object.h"
 #include "memory.h"
 
-struct vm vm;
+_Thread_local struct vm *vm;
 static void runtime_error(const char *format, ...);
 
 static bool clock_native(int argc, value_t *args, value_t *res)
@@ -22,8 +22,7 @@ static bool clock_native(int argc, value_t *args, value_t *res)
 /* return a random number btw 0 and 1*/
 static bool rand_native(int argc, value_t *args, value_t *res)
 {
-	srand(time(NULL));
-	*res = NUMBER((double)(rand() % 1000) / 1000);
+	*res = NUMBER((double)(rand_r(&vm->rand_seed) % 1000) / 1000);
 	return true;
 }
 
@@ -41,7 +40,10 @@ static bool input_native(int argc, value_t *args, value_t *res)
 		return false;
 	}
 
-	printf("%s\n", AS_CSTRING(args[0]));
+	obj_string_t *prompt = AS_STRING(args[0]);
+	output_write(&vm->out, prompt->chars, prompt->length);
+	output_char(&vm->out, '\n');
+	flush_output(&vm->out);
 
 	char input[512];
 	scanf("%511s", input);
@@ -68,6 +70,8 @@ static bool str_to_number_native(int argc, value_t *args, value_t *res)
 		return false;
 	}
 
+	/* a string borrowed from the source ends in its closing quote rather
+	 * than a NUL, which stops strtod just the same*/
 	double d = strtod(AS_CSTRING(args[0]), NULL);
 	*res = NUMBER(d);
 
@@ -76,53 +80,134 @@ static bool str_to_number_native(int argc, value_t *args, value_t *res)
 
 static inline void reset_stack()
 {
-	vm.stack_top = vm.stack;
-	vm.frame_count = 0;
+	vm->stack_top = vm->stack;
+	vm->frame_count = 0;
 }
 
-static value_t peek(int dist)
+/* move the value stack into a block of capacity values and point the frames
+ * at the new copy. The old block stays valid until everything is relocated*/
+static void grow_stack(int capacity)
 {
-	return vm.stack_top[-1 - dist];
+	value_t *stack = malloc(sizeof(value_t) * capacity);
+	if (!stack) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+	memcpy(stack, vm->stack, sizeof(value_t) * vm->stack_capacity);
+
+	for (int i = 0; i < vm->frame_count; i++)
+		vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+	vm->stack_top = stack + (vm->stack_top - vm->stack);
+
+	free(vm->stack);
+	vm->stack = stack;
+	vm->stack_capacity = capacity;
+}
+
+/* make room for needed values on the value stack, failing once that would
+ * take more than max_frames frames' worth*/
+static bool reserve_stack(size_t needed)
+{
+	if (needed <= (size_t)vm->stack_capacity)
+		return true;
+	if (needed > (size_t)vm->max_frames * FRAME_SLOTS)
+		return false;
+
+	size_t capacity = vm->stack_capacity;
+	while (capacity < needed)
+		capacity *= 2;
+	grow_stack((int)capacity);
+	return true;
+}
+
+/* frames a stack trace shows at either end. Runaway recursion nests calls
+ * up to max_frames deep, and the frames in between add nothing*/
+#define TRACE_FRAMES 10
+
+static void print_frame(struct call_frame *frame)
+{
+	obj_function_t *function = frame->function;
+	/* ip points to next instruction*/
+
+	size_t instruction = frame->ip - frame->function->chunk.code - 1;
+	fprintf(vm->err, "[line %d] in ",
+		get_line_number(&function->chunk, instruction));
+
+	if (function->name) {
+		fprintf(vm->err, "%s() \n", function->name->chars);
+	} else {
+		fprintf(vm->err, "script\n");
+	}
 }
 
 static void runtime_error(const char *format, ...)
 {
 	va_list args;
+	/* what was printed before the error comes out before it*/
+	flush_output(&vm->out);
 	va_start(args, format);
-	vfprintf(stderr, format, args);
+	vfprintf(vm->err, format, args);
 	va_end(args);
-	fputs("\n", stderr);
-
-	/* vomit stack trace*/
-	for (int i = vm.frame_count - 1; i >= 0; i--) {
-		struct call_frame *frame = &vm.frames[i];
-		obj_function_t *function = frame->function;
-		/* ip points to next instruction*/
+	fputs("\n", vm->err);
 
-		size_t instruction =
-			frame->ip - frame->function->chunk.code - 1;
-		fprintf(stderr, "[line %d] in ",
-			get_line_number(&function->chunk, instruction));
-
-		if (function->name) {
-			fprintf(stderr, "%s() \n", function->name->chars);
-		} else {
-			fprintf(stderr, "script\n");
+	/* vomit stack trace, innermost call first*/
+	int top = vm->frame_count - 1;
+	for (int i = top; i >= 0; i--) {
+		if (i == top - TRACE_FRAMES && i > TRACE_FRAMES) {
+			fprintf(vm->err, "... %d frames omitted\n",
+				i - TRACE_FRAMES + 1);
+			i = TRACE_FRAMES - 1;
 		}
+		print_frame(&vm->frames[i]);
 	}
 
 	reset_stack();
 }
 
+int global_slot(obj_string_t *name)
+{
+	value_t index;
+	if (table_get(&vm->global_names, name, &index))
+		return (int)AS_NUMBER(index);
+
+	/* name may not be reachable from anywhere else yet*/
+	push(OBJ(name));
+	if (vm->global_count + 1 > vm->global_capacity) {
+		int old = vm->global_capacity;
+		vm->global_capacity = GROW_CAPACITY(old);
+		vm->globals = GROW_ARRAY(vm->globals, struct global, old,
+					vm->global_capacity);
+	}
+
+	int slot = vm->global_count++;
+	vm->globals[slot].value = NIL_VAL;
+	vm->globals[slot].name = name;
+	vm->globals[slot].defined = false;
+	table_set(&vm->global_names, name, NUMBER(slot));
+	pop();
+
+	return slot;
+}
+
 static void define_native(const char *name, native_fn_t function, int arity)
 {
 	push(OBJ(copy_string((char *)name, (int)strlen(name))));
 	push(OBJ(new_native(function, arity)));
-	table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+	int slot = global_slot(AS_STRING(vm->stack[0]));
+	vm->globals[slot].value = vm->stack[1];
+	vm->globals[slot].defined = true;
 	pop();
 	pop();
 }
 
+static void define_natives()
+{
+	define_native("clock", clock_native, 0);
+	define_native("random", rand_native, 0);
+	define_native("input", input_native, 1);
+	define_native("toNumber", str_to_number_native, 1);
+}
+
 static bool call(obj_function_t *f, uint8_t argc)
 {
 	if (f->arity != argc) {
@@ -131,16 +216,28 @@ static bool call(obj_function_t *f, uint8_t argc)
 		return false;
 	}
 
-	if (vm.frame_count == FRAMES_MAX) {
+	if (vm->frame_count == vm->max_frames ||
+	    !reserve_stack(vm->stack_top - vm->stack - argc - 1 + f->max_stack +
+			   STACK_SPARE)) {
 		runtime_error("Stack Overflow.");
 		return false;
 	}
 
-	struct call_frame *frame = &vm.frames[vm.frame_count++];
+	if (vm->frame_count == vm->frame_capacity) {
+		vm->frame_capacity *= 2;
+		vm->frames = realloc(vm->frames, sizeof(struct call_frame) *
+						       vm->frame_capacity);
+		if (!vm->frames) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(74);
+		}
+	}
+
+	struct call_frame *frame = &vm->frames[vm->frame_count++];
 	frame->function = f;
 	frame->ip = f->chunk.code;
 	/* args on stack line up with function parameters.*/
-	frame->slots = vm.stack_top - argc - 1;
+	frame->slots = vm->stack_top - argc - 1;
 
 	return true;
 }
@@ -152,9 +249,15 @@ static bool call_native(obj_native_t *native, int argc)
 			      argc);
 		return false;
 	}
+	/* natives only ever see flat strings*/
+	for (value_t *arg = vm->stack_top - argc; arg < vm->stack_top; arg++) {
+		if (IS_ROPE(*arg))
+			*arg = OBJ(flatten_rope(AS_ROPE(*arg)));
+	}
+
 	native_fn_t fn = native->function;
 	value_t result;
-	bool status = fn(argc, vm.stack_top - argc, &result);
+	bool status = fn(argc, vm->stack_top - argc, &result);
 
 	/*Native functions operate like so: if an error occurs,
 	the error message is stored
@@ -164,7 +267,7 @@ static bool call_native(obj_native_t *native, int argc)
 		runtime_error(AS_CSTRING(result));
 		return false;
 	}
-	vm.stack_top -= argc + 1;
+	vm->stack_top -= argc + 1;
 	push(result);
 	return true;
 }
@@ -186,264 +289,738 @@ static bool call_value(value_t callee, int argc)
 	return false;
 }
 
-static bool is_falsy(value_t v)
+static inline bool is_text(value_t v)
+{
+	return IS_STRING(v) || IS_ROPE(v);
+}
+
+static inline int text_length(value_t v)
+{
+	return IS_STRING(v) ? AS_STRING(v)->length : AS_ROPE(v)->length;
+}
+
+/* a flattened rope is replaced by its string so the old pieces can die*/
+static inline struct obj *rope_piece(value_t v)
 {
-	return (IS_NIL(v) || (IS_BOOL(v) && !(AS_BOOL(v))));
+	if (IS_ROPE(v) && AS_ROPE(v)->flat)
+		return (struct obj *)AS_ROPE(v)->flat;
+	return AS_OBJ(v);
 }
 
 static void concatenate()
 {
-	obj_string_t *a = AS_STRING(pop());
-	obj_string_t *b = AS_STRING(pop());
+	/* operands stay on the stack until the result exists, so a collection
+	 * triggered by the allocation can't free them*/
+	value_t a = vm->stack_top[-1];
+	value_t b = vm->stack_top[-2];
+	int len = text_length(a) + text_length(b);
+	value_t r;
+
+	if (text_length(a) == 0) {
+		r = b;
+	} else if (text_length(b) == 0) {
+		r = a;
+	} else if (len >= ROPE_MIN_LENGTH || !IS_STRING(a) || !IS_STRING(b)) {
+		/* defer the copy: repeated concatenation stays linear*/
+		r = OBJ(new_rope(rope_piece(b), rope_piece(a), len));
+	} else {
+		obj_string_t *sa = AS_STRING(a);
+		obj_string_t *sb = AS_STRING(b);
+
+		char *chars = ALLOCATE(char, len + 1);
+		memcpy(chars, sb->chars, sb->length);
+		memcpy(chars + sb->length, sa->chars, sa->length);
+		chars[len] = '\0';
+
+		r = OBJ(take_string(chars, len));
+	}
+
+	pop();
+	pop();
+	push(r);
+}
+
+#ifdef DEBUG_PROFILE_OPCODES
+/* how often each opcode ran right after each other one. The most frequent
+ * pairs are the candidates for superinstructions*/
+static _Thread_local uint64_t op_pairs[UINT8_COUNT][UINT8_COUNT];
+static _Thread_local uint8_t last_op;
+
+struct op_pair {
+	uint8_t first;
+	uint8_t second;
+	uint64_t count;
+};
+
+static int compare_op_pairs(const void *a, const void *b)
+{
+	uint64_t x = ((const struct op_pair *)a)->count;
+	uint64_t y = ((const struct op_pair *)b)->count;
+	return (x < y) - (x > y);
+}
+
+static void print_opcode_profile()
+{
+	struct op_pair *pairs = malloc(sizeof(struct op_pair) * UINT8_COUNT *
+				       UINT8_COUNT);
+	uint64_t total = 0;
+	int count = 0;
 
-	int len = a->length + b->length;
-	char *chars = ALLOCATE(char, len + 1);
-	memcpy(chars, b->chars, b->length);
-	memcpy(chars + b->length, a->chars, a->length);
-	chars[len] = '\0';
+	for (int i = 0; i < UINT8_COUNT; i++) {
+		for (int j = 0; j < UINT8_COUNT; j++) {
+			if (!op_pairs[i][j])
+				continue;
+			pairs[count].first = i;
+			pairs[count].second = j;
+			pairs[count].count = op_pairs[i][j];
+			total += op_pairs[i][j];
+			count++;
+		}
+	}
+	qsort(pairs, count, sizeof(struct op_pair), compare_op_pairs);
 
-	obj_string_t *r = take_string(chars, len);
-	push(OBJ(r));
+	fprintf(stderr, "-- opcode pairs, %llu instructions --\n",
+		(unsigned long long)total);
+	for (int i = 0; i < count && i < 25; i++) {
+		fprintf(stderr, "%12llu %5.1f%%  %-22s %s\n",
+			(unsigned long long)pairs[i].count,
+			100.0 * pairs[i].count / total,
+			opcode_name(pairs[i].first),
+			opcode_name(pairs[i].second));
+	}
+	free(pairs);
 }
 
-static interpret_result_t run_vm()
+#define PROFILE_INSTRUCTION() (op_pairs[last_op][*ip]++, last_op = *ip)
+#else
+#define PROFILE_INSTRUCTION() \
+	do {                  \
+	} while (0)
+#endif
+
+/* run until the frame at index base returns, leaving its result on the
+ * stack. Frames below base belong to whoever called in*/
+static interpret_result_t run_vm(int base)
 {
-	struct call_frame *frame = &vm.frames[vm.frame_count - 1];
+	/* the hot interpreter state lives in locals. It is written back to the
+	 * frame (ip) and to vm->stack_top before anything that can inspect it:
+	 * calls, runtime errors and allocations*/
+	struct call_frame *frame;
+	uint8_t *ip;
+	value_t *constants;
+	value_t *sp = vm->stack_top;
 
-#define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() \
-	(frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | (frame->ip[-1])))
-#define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
-#define READ_CONSTANT_LONG(i) (frame->function->chunk.constants.values[i])
+#define LOAD_FRAME()                                               \
+	do {                                                       \
+		frame = &vm->frames[vm->frame_count - 1];            \
+		ip = frame->ip;                                    \
+		constants = frame->function->chunk.constants.values; \
+	} while (0)
+#define STORE_FRAME() (frame->ip = ip)
+#define STORE_STACK() (vm->stack_top = sp)
+#define LOAD_STACK() (sp = vm->stack_top)
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define DROP() (sp--)
+#define PEEK(dist) (sp[-1 - (dist)])
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | (ip[-1])))
+#define READ_LONG() \
+	(ip += 3, (uint32_t)((ip[-3] << 16) | (ip[-2] << 8) | (ip[-1])))
+#define READ_CONSTANT() (constants[READ_BYTE()])
+#define READ_CONSTANT_LONG(i) (constants[i])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_GLOBAL() (&vm->globals[READ_BYTE()])
+#define READ_GLOBAL_LONG() (&vm->globals[READ_LONG()])
+
+#define RUNTIME_ERROR(...)                      \
+	do {                                    \
+		STORE_FRAME();                  \
+		runtime_error(__VA_ARGS__);     \
+		return INTERPRET_RUNTIME_ERROR; \
+	} while (0)
 
 #define OP_BINARY(value_type, o)                                   \
 	do {                                                       \
-		if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {  \
-			runtime_error("Operands must be numbers"); \
-			return INTERPRET_RUNTIME_ERROR;            \
-		}                                                  \
-		double b = AS_NUMBER(pop());                       \
-		double a = AS_NUMBER(pop());                       \
-		push(value_type(a o b));                           \
+		if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))    \
+			RUNTIME_ERROR("Operands must be numbers"); \
+		double b = AS_NUMBER(POP());                       \
+		double a = AS_NUMBER(POP());                       \
+		PUSH(value_type(a o b));                           \
+	} while (0)
+
+/* add the top two values, which must both be numbers or both be text*/
+#define ADD_VALUES()                                                        \
+	do {                                                                \
+		if (is_text(PEEK(0)) && is_text(PEEK(1))) {                 \
+			STORE_STACK();                                      \
+			concatenate();                                      \
+			LOAD_STACK();                                       \
+		} else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {      \
+			double b = AS_NUMBER(POP());                        \
+			double a = AS_NUMBER(POP());                        \
+			PUSH(NUMBER(a + b));                                \
+		} else {                                                    \
+			RUNTIME_ERROR(                                      \
+				"Operands must be two numbers or two strings"); \
+		}                                                           \
+	} while (0)
+
+#ifdef QUICKEN
+/* replace the one byte instruction being run with a specialized form. The
+ * specialized handlers guard on their operand types and fall back to the
+ * generic path on a miss, leaving the instruction as it is*/
+#define QUICKEN_TO(op)                    \
+	do {                              \
+		if (vm->quicken)           \
+			ip[-1] = (op);    \
+	} while (0)
+#else
+#define QUICKEN_TO(op) \
+	do {           \
 	} while (0)
+#endif
+
+/* >= and <= are the negations of < and >, which differ for NaN*/
+#define NOT_BOOL(b) BOOL(!(b))
 
-	uint8_t instruction;
+/* equal strings are the same interned object once flat*/
+#define FLATTEN_OPERANDS()                                              \
+	do {                                                            \
+		if (IS_ROPE(PEEK(0)) || IS_ROPE(PEEK(1))) {             \
+			STORE_STACK();                                  \
+			for (int i = 0; i < 2; i++) {                   \
+				if (IS_ROPE(PEEK(i)))                   \
+					PEEK(i) = OBJ(flatten_rope(     \
+						AS_ROPE(PEEK(i)))); \
+			}                                               \
+		}                                                       \
+	} while (0)
 
-	for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-		disassemble_instruction(
-			&frame->function->chunk,
-			(int)(frame->ip - frame->function->chunk.code));
-		printf("          ");
-		for (value_t *s = vm.stack; s != vm.stack_top; ++s) {
-			printf("[");
-			print_value(*s);
-			printf(" ]");
-		}
-		printf("\n");
+#define TRACE_INSTRUCTION()                                                   \
+	do {                                                                  \
+		STORE_STACK(); /* printing may flatten a rope */              \
+		disassemble_instruction(                                      \
+			&frame->function->chunk,                              \
+			(int)(ip - frame->function->chunk.code));             \
+		printf("          ");                                         \
+		for (value_t *s = vm->stack; s != sp; ++s) {                   \
+			printf("[");                                          \
+			print_value(*s);                                      \
+			printf(" ]");                                         \
+		}                                                             \
+		printf("\n");                                                 \
+	} while (0)
+#else
+#define TRACE_INSTRUCTION() \
+	do {                \
+	} while (0)
 #endif
-		switch (instruction = READ_BYTE()) {
-		case OP_RETURN: {
-			value_t result = pop();
-			vm.frame_count--;
-			if (vm.frame_count == 0) {
-				pop();
-				return INTERPRET_OK;
-			}
 
-			vm.stack_top = frame->slots;
-			push(result);
+#ifdef COMPUTED_GOTO
+	/* one indirect jump per handler instead of a single shared one gives
+	 * the branch predictor a chance on tight loops*/
+	static void *dispatch_table[] = {
+		[OP_RETURN] = &&do_OP_RETURN,
+		[OP_CONSTANT] = &&do_OP_CONSTANT,
+		[OP_NIL] = &&do_OP_NIL,
+		[OP_FALSE] = &&do_OP_FALSE,
+		[OP_TRUE] = &&do_OP_TRUE,
+		[OP_CONSTANT_LONG] = &&do_OP_CONSTANT_LONG,
+		[OP_NEGATE] = &&do_OP_NEGATE,
+		[OP_ADD] = &&do_OP_ADD,
+		[OP_SUB] = &&do_OP_SUB,
+		[OP_MULT] = &&do_OP_MULT,
+		[OP_DIV] = &&do_OP_DIV,
+		[OP_NOT] = &&do_OP_NOT,
+		[OP_EQUAL] = &&do_OP_EQUAL,
+		[OP_GREATER] = &&do_OP_GREATER,
+		[OP_LESS] = &&do_OP_LESS,
+		[OP_PRINT] = &&do_OP_PRINT,
+		[OP_POP] = &&do_OP_POP,
+		[OP_POPX] = &&do_OP_POPX,
+		[OP_DEFINE_GLOBAL] = &&do_OP_DEFINE_GLOBAL,
+		[OP_GET_GLOBAL] = &&do_OP_GET_GLOBAL,
+		[OP_SET_GLOBAL] = &&do_OP_SET_GLOBAL,
+		[OP_GET_LOCAL] = &&do_OP_GET_LOCAL,
+		[OP_SET_LOCAL] = &&do_OP_SET_LOCAL,
+		[OP_JUMP_IF_FALSE] = &&do_OP_JUMP_IF_FALSE,
+		[OP_JUMP] = &&do_OP_JUMP,
+		[OP_LOOP] = &&do_OP_LOOP,
+		[OP_CALL] = &&do_OP_CALL,
+		[OP_DEFINE_GLOBAL_LONG] = &&do_OP_DEFINE_GLOBAL_LONG,
+		[OP_GET_GLOBAL_LONG] = &&do_OP_GET_GLOBAL_LONG,
+		[OP_SET_GLOBAL_LONG] = &&do_OP_SET_GLOBAL_LONG,
+		[OP_NOT_EQUAL] = &&do_OP_NOT_EQUAL,
+		[OP_GREATER_EQUAL] = &&do_OP_GREATER_EQUAL,
+		[OP_LESS_EQUAL] = &&do_OP_LESS_EQUAL,
+		[OP_JUMP_IF_FALSE_POP] = &&do_OP_JUMP_IF_FALSE_POP,
+		[OP_LESS_JUMP] = &&do_OP_LESS_JUMP,
+		[OP_ADD_LOCALS] = &&do_OP_ADD_LOCALS,
+		[OP_ADD_LOCAL_CONST] = &&do_OP_ADD_LOCAL_CONST,
+		[OP_SUB_LOCAL_CONST] = &&do_OP_SUB_LOCAL_CONST,
+		[OP_LESS_LOCAL_CONST_JUMP] = &&do_OP_LESS_LOCAL_CONST_JUMP,
+		[OP_SET_LOCAL_POP] = &&do_OP_SET_LOCAL_POP,
+		[OP_SET_GLOBAL_POP] = &&do_OP_SET_GLOBAL_POP,
+		[OP_TAIL_CALL] = &&do_OP_TAIL_CALL,
+		[OP_ADD_NUM] = &&do_OP_ADD_NUM,
+		[OP_ADD_STR] = &&do_OP_ADD_STR,
+	};
 
-			frame = &vm.frames[vm.frame_count - 1];
-			break;
-		}
+#define DISPATCH()                                  \
+	do {                                        \
+		TRACE_INSTRUCTION();                \
+		PROFILE_INSTRUCTION();              \
+		goto *dispatch_table[READ_BYTE()]; \
+	} while (0)
+#define CASE(op) do_##op
+#define SWITCH_START DISPATCH();
+#define SWITCH_END
+#else
+#define DISPATCH() goto dispatch
+#define CASE(op) case op
+#define SWITCH_START  \
+	dispatch:             \
+	TRACE_INSTRUCTION(); \
+	PROFILE_INSTRUCTION(); \
+	switch (READ_BYTE()) {
+#define SWITCH_END }
+#endif
 
-		case OP_CONSTANT: {
-			value_t constant = READ_CONSTANT();
-			push(constant);
-			break;
-		}
-		case OP_CONSTANT_LONG: {
-			uint32_t i = READ_BYTE();
-			i = (i << 8) | READ_BYTE();
-			i = (i << 8) | READ_BYTE();
+	LOAD_FRAME();
 
-			value_t constant = READ_CONSTANT_LONG(i);
-			push(constant);
-			break;
-		}
-		case OP_NEGATE:
-			if (!IS_NUMBER(peek(0))) {
-				runtime_error("Operand must be a number");
-				return INTERPRET_RUNTIME_ERROR;
-			}
-			push(NUMBER(-AS_NUMBER(pop())));
-			break;
-		case OP_ADD:
-			if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-				concatenate();
-				break;
-			} else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-				double a = AS_NUMBER(pop());
-				double b = AS_NUMBER(pop());
-
-				push(NUMBER(a + b));
-				break;
-			} else {
-				runtime_error(
-					"Operands must be two numbers or two strings");
-				return INTERPRET_RUNTIME_ERROR;
-			}
-		case OP_SUB:
-			OP_BINARY(NUMBER, -);
-			break;
-		case OP_MULT:
-			OP_BINARY(NUMBER, *);
-			break;
-		case OP_DIV:
-			OP_BINARY(NUMBER, /);
-			break;
-		case OP_FALSE:
-			push(BOOL(false));
-			break;
-		case OP_TRUE:
-			push(BOOL(true));
-			break;
-		case OP_NIL:
-			push(NIL_VAL);
-			break;
-		case OP_NOT:
-			push(BOOL(is_falsy(pop())));
-			break;
-		case OP_EQUAL: {
-			value_t a = pop();
-			value_t b = pop();
+	SWITCH_START
 
-			push(BOOL(values_equal(a, b)));
-			break;
+	CASE(OP_RETURN) : {
+		value_t result = POP();
+		vm->frame_count--;
+		sp = frame->slots;
+		PUSH(result);
+
+		if (vm->frame_count == base) {
+			STORE_STACK();
+			return INTERPRET_OK;
 		}
-		case OP_GREATER:
-			OP_BINARY(BOOL, >);
-			break;
-		case OP_LESS:
-			OP_BINARY(BOOL, <);
-			break;
-		case OP_PRINT:
-			print_value(pop());
-			printf("\n");
-			break;
-		case OP_POP:
-			pop();
-			break;
-		case OP_POPX:
-			if (vm.repl_mode) {
-				print_value(pop());
-				printf("\n");
-			} else {
-				pop();
-			}
-			break;
-		case OP_DEFINE_GLOBAL: {
-			obj_string_t *name = READ_STRING();
-			table_set(&vm.globals, name, peek(0));
-			pop();
-			break;
+
+		LOAD_FRAME();
+		DISPATCH();
+	}
+
+	CASE(OP_CONSTANT) : {
+		value_t constant = READ_CONSTANT();
+		PUSH(constant);
+		DISPATCH();
+	}
+	CASE(OP_CONSTANT_LONG) : {
+		value_t constant = READ_CONSTANT_LONG(READ_LONG());
+		PUSH(constant);
+		DISPATCH();
+	}
+	CASE(OP_NEGATE) :
+		if (!IS_NUMBER(PEEK(0)))
+			RUNTIME_ERROR("Operand must be a number");
+		PEEK(0) = NUMBER(-AS_NUMBER(PEEK(0)));
+		DISPATCH();
+	CASE(OP_ADD) :
+		if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+			QUICKEN_TO(OP_ADD_NUM);
+		else if (is_text(PEEK(0)) && is_text(PEEK(1)))
+			QUICKEN_TO(OP_ADD_STR);
+		ADD_VALUES();
+		DISPATCH();
+	CASE(OP_ADD_NUM) :
+		if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+			double b = AS_NUMBER(POP());
+			double a = AS_NUMBER(POP());
+			PUSH(NUMBER(a + b));
+			DISPATCH();
 		}
-		case OP_GET_GLOBAL: {
-			obj_string_t *name = READ_STRING();
-			value_t val;
-			if (!table_get(&vm.globals, name, &val)) {
-				runtime_error("Undefined variable '%s'",
-					      name->chars);
-				return INTERPRET_RUNTIME_ERROR;
-			}
-			push(val);
-			break;
+		ADD_VALUES();
+		DISPATCH();
+	CASE(OP_ADD_STR) :
+		if (is_text(PEEK(0)) && is_text(PEEK(1))) {
+			STORE_STACK();
+			concatenate();
+			LOAD_STACK();
+			DISPATCH();
 		}
-		case OP_SET_GLOBAL: {
-			obj_string_t *name = READ_STRING();
-			if (table_set(&vm.globals, name, peek(0))) {
-				table_delete(&vm.globals, name); /* delete
-								    zombie
-								    value*/
-				runtime_error("Undefined variable '%s'.",
-					      name->chars);
-				return INTERPRET_RUNTIME_ERROR;
-			}
+		ADD_VALUES();
+		DISPATCH();
+	CASE(OP_SUB) :
+		OP_BINARY(NUMBER, -);
+		DISPATCH();
+	CASE(OP_MULT) :
+		OP_BINARY(NUMBER, *);
+		DISPATCH();
+	CASE(OP_DIV) :
+		OP_BINARY(NUMBER, /);
+		DISPATCH();
+	CASE(OP_FALSE) :
+		PUSH(BOOL(false));
+		DISPATCH();
+	CASE(OP_TRUE) :
+		PUSH(BOOL(true));
+		DISPATCH();
+	CASE(OP_NIL) :
+		PUSH(NIL_VAL);
+		DISPATCH();
+	CASE(OP_NOT) :
+		PEEK(0) = BOOL(is_falsy(PEEK(0)));
+		DISPATCH();
+	CASE(OP_EQUAL) : {
+		FLATTEN_OPERANDS();
+		value_t a = POP();
+		value_t b = POP();
 
-			break;
-		}
+		PUSH(BOOL(values_equal(a, b)));
+		DISPATCH();
+	}
+	CASE(OP_NOT_EQUAL) : {
+		FLATTEN_OPERANDS();
+		value_t a = POP();
+		value_t b = POP();
 
-		case OP_GET_LOCAL: {
-			uint8_t slot = READ_BYTE();
-			push(frame->slots[slot]);
-			break;
+		PUSH(BOOL(!values_equal(a, b)));
+		DISPATCH();
+	}
+	CASE(OP_GREATER) :
+		OP_BINARY(BOOL, >);
+		DISPATCH();
+	CASE(OP_LESS) :
+		OP_BINARY(BOOL, <);
+		DISPATCH();
+	CASE(OP_GREATER_EQUAL) :
+		OP_BINARY(NOT_BOOL, <);
+		DISPATCH();
+	CASE(OP_LESS_EQUAL) :
+		OP_BINARY(NOT_BOOL, >);
+		DISPATCH();
+	CASE(OP_PRINT) :
+		/* keep the value on the stack while printing flattens ropes*/
+		STORE_STACK();
+		output_value(&vm->out, PEEK(0));
+		output_char(&vm->out, '\n');
+		DROP();
+		DISPATCH();
+	CASE(OP_POP) :
+		DROP();
+		DISPATCH();
+	CASE(OP_POPX) :
+		if (vm->repl_mode) {
+			STORE_STACK();
+			output_value(&vm->out, PEEK(0));
+			output_char(&vm->out, '\n');
+			DROP();
+		} else {
+			DROP();
 		}
+		DISPATCH();
+	CASE(OP_DEFINE_GLOBAL) : {
+		struct global *global = READ_GLOBAL();
+		global->value = POP();
+		global->defined = true;
+		DISPATCH();
+	}
+	CASE(OP_GET_GLOBAL) : {
+		struct global *global = READ_GLOBAL();
+		if (!global->defined)
+			RUNTIME_ERROR("Undefined variable '%s'",
+				      global->name->chars);
+		PUSH(global->value);
+		DISPATCH();
+	}
+	CASE(OP_SET_GLOBAL) : {
+		struct global *global = READ_GLOBAL();
+		if (!global->defined)
+			RUNTIME_ERROR("Undefined variable '%s'.",
+				      global->name->chars);
+		global->value = PEEK(0);
+		DISPATCH();
+	}
+	CASE(OP_DEFINE_GLOBAL_LONG) : {
+		struct global *global = READ_GLOBAL_LONG();
+		global->value = POP();
+		global->defined = true;
+		DISPATCH();
+	}
+	CASE(OP_GET_GLOBAL_LONG) : {
+		struct global *global = READ_GLOBAL_LONG();
+		if (!global->defined)
+			RUNTIME_ERROR("Undefined variable '%s'",
+				      global->name->chars);
+		PUSH(global->value);
+		DISPATCH();
+	}
+	CASE(OP_SET_GLOBAL_LONG) : {
+		struct global *global = READ_GLOBAL_LONG();
+		if (!global->defined)
+			RUNTIME_ERROR("Undefined variable '%s'.",
+				      global->name->chars);
+		global->value = PEEK(0);
+		DISPATCH();
+	}
 
-		case OP_SET_LOCAL: {
-			/* we don't pop: result of asgnt is the expr on the
-			 * left*/
-			uint8_t slot = READ_BYTE();
-			frame->slots[slot] = peek(0);
-			break;
-		}
+	CASE(OP_GET_LOCAL) : {
+		uint8_t slot = READ_BYTE();
+		PUSH(frame->slots[slot]);
+		DISPATCH();
+	}
 
-		case OP_JUMP_IF_FALSE: {
-			uint16_t offset = READ_SHORT();
-			if (is_falsy(peek(0)))
-				frame->ip += offset;
-			break;
-		}
-		case OP_JUMP: {
-			/* unconditional jump*/
-			uint16_t offset = READ_SHORT();
-			frame->ip += offset;
-			break;
+	CASE(OP_SET_LOCAL) : {
+		/* we don't pop: result of asgnt is the expr on the left*/
+		uint8_t slot = READ_BYTE();
+		frame->slots[slot] = PEEK(0);
+		DISPATCH();
+	}
+
+	CASE(OP_JUMP_IF_FALSE) : {
+		uint16_t offset = READ_SHORT();
+		if (is_falsy(PEEK(0)))
+			ip += offset;
+		DISPATCH();
+	}
+	CASE(OP_JUMP_IF_FALSE_POP) : {
+		uint16_t offset = READ_SHORT();
+		if (is_falsy(POP()))
+			ip += offset;
+		DISPATCH();
+	}
+	CASE(OP_LESS_JUMP) : {
+		/* jumps when the comparison is false, like the OP_LESS and
+		 * OP_JUMP_IF_FALSE_POP it replaces*/
+		uint16_t offset = READ_SHORT();
+		if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+			RUNTIME_ERROR("Operands must be numbers");
+		double b = AS_NUMBER(POP());
+		double a = AS_NUMBER(POP());
+		if (!(a < b))
+			ip += offset;
+		DISPATCH();
+	}
+	CASE(OP_ADD_LOCALS) : {
+		value_t a = frame->slots[READ_BYTE()];
+		value_t b = frame->slots[READ_BYTE()];
+		if (IS_NUMBER(a) && IS_NUMBER(b)) {
+			PUSH(NUMBER(AS_NUMBER(a) + AS_NUMBER(b)));
+			DISPATCH();
 		}
-		case OP_LOOP: {
-			uint16_t offset = READ_SHORT();
-			frame->ip -= offset;
-			break;
+		/* strings and type errors take the long way*/
+		PUSH(a);
+		PUSH(b);
+		ADD_VALUES();
+		DISPATCH();
+	}
+	CASE(OP_ADD_LOCAL_CONST) : {
+		value_t a = frame->slots[READ_BYTE()];
+		value_t b = READ_CONSTANT();
+		if (IS_NUMBER(a) && IS_NUMBER(b)) {
+			PUSH(NUMBER(AS_NUMBER(a) + AS_NUMBER(b)));
+			DISPATCH();
 		}
-		case OP_CALL: {
-			uint8_t argc = READ_BYTE();
-			if (!call_value(peek(argc), argc)) {
-				return INTERPRET_RUNTIME_ERROR;
+		PUSH(a);
+		PUSH(b);
+		ADD_VALUES();
+		DISPATCH();
+	}
+	CASE(OP_SUB_LOCAL_CONST) : {
+		value_t a = frame->slots[READ_BYTE()];
+		value_t b = READ_CONSTANT();
+		if (!IS_NUMBER(a) || !IS_NUMBER(b))
+			RUNTIME_ERROR("Operands must be numbers");
+		PUSH(NUMBER(AS_NUMBER(a) - AS_NUMBER(b)));
+		DISPATCH();
+	}
+	CASE(OP_LESS_LOCAL_CONST_JUMP) : {
+		value_t a = frame->slots[READ_BYTE()];
+		value_t b = READ_CONSTANT();
+		uint16_t offset = READ_SHORT();
+		if (!IS_NUMBER(a) || !IS_NUMBER(b))
+			RUNTIME_ERROR("Operands must be numbers");
+		if (!(AS_NUMBER(a) < AS_NUMBER(b)))
+			ip += offset;
+		DISPATCH();
+	}
+	CASE(OP_SET_LOCAL_POP) : {
+		uint8_t slot = READ_BYTE();
+		frame->slots[slot] = POP();
+		DISPATCH();
+	}
+	CASE(OP_SET_GLOBAL_POP) : {
+		struct global *global = READ_GLOBAL();
+		if (!global->defined)
+			RUNTIME_ERROR("Undefined variable '%s'.",
+				      global->name->chars);
+		global->value = POP();
+		DISPATCH();
+	}
+	CASE(OP_JUMP) : {
+		/* unconditional jump*/
+		uint16_t offset = READ_SHORT();
+		ip += offset;
+		DISPATCH();
+	}
+	CASE(OP_LOOP) : {
+		uint16_t offset = READ_SHORT();
+		ip -= offset;
+		DISPATCH();
+	}
+	CASE(OP_CALL) : {
+		uint8_t argc = READ_BYTE();
+		STORE_FRAME();
+		STORE_STACK();
+		if (!call_value(PEEK(argc), argc))
+			return INTERPRET_RUNTIME_ERROR;
+		/* update frame*/
+		LOAD_STACK();
+		LOAD_FRAME();
+		DISPATCH();
+	}
+
+	CASE(OP_TAIL_CALL) : {
+		uint8_t argc = READ_BYTE();
+		value_t callee = PEEK(argc);
+
+		if (IS_FUNCTION(callee) && AS_FUNCTION(callee)->arity == argc) {
+			/* the caller's frame is done with: slide the callee and
+			 * its arguments down over it and start again*/
+			obj_function_t *f = AS_FUNCTION(callee);
+			size_t needed = frame->slots - vm->stack +
+					f->max_stack + STACK_SPARE;
+			if (needed > (size_t)vm->stack_capacity) {
+				STORE_STACK();
+				if (!reserve_stack(needed))
+					RUNTIME_ERROR("Stack Overflow.");
+				LOAD_STACK();
 			}
-			/* update frame*/
-			frame = &vm.frames[vm.frame_count - 1];
-			break;
-		}
+
+			memmove(frame->slots, sp - argc - 1,
+				sizeof(value_t) * (argc + 1));
+			sp = frame->slots + argc + 1;
+			frame->function = f;
+			ip = f->chunk.code;
+			constants = f->chunk.constants.values;
+			DISPATCH();
 		}
+
+		/* natives and errors go the usual way; the OP_RETURN that
+		 * follows hands a native's result back*/
+		STORE_FRAME();
+		STORE_STACK();
+		if (!call_value(callee, argc))
+			return INTERPRET_RUNTIME_ERROR;
+		LOAD_STACK();
+		LOAD_FRAME();
+		DISPATCH();
 	}
 
+	SWITCH_END
+
+	/* every handler ends in a dispatch*/
+	return INTERPRET_RUNTIME_ERROR;
+
+#undef LOAD_FRAME
+#undef STORE_FRAME
+#undef STORE_STACK
+#undef LOAD_STACK
+#undef PUSH
+#undef POP
+#undef DROP
+#undef PEEK
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_LONG
 #undef READ_CONSTANT
 #undef READ_CONSTANT_LONG
 #undef READ_STRING
-#undef BINARY_OP
+#undef READ_GLOBAL
+#undef READ_GLOBAL_LONG
+#undef RUNTIME_ERROR
+#undef OP_BINARY
+#undef ADD_VALUES
+#undef QUICKEN_TO
+#undef NOT_BOOL
+#undef FLATTEN_OPERANDS
+#undef TRACE_INSTRUCTION
+#undef DISPATCH
+#undef CASE
+#undef SWITCH_START
+#undef SWITCH_END
 }
 
 void init_vm()
 {
-	vm.objects = NULL;
-	vm.repl_mode = false;
-	init_table(&vm.strings);
-	init_table(&vm.globals);
+	vm->objects = NULL;
+	vm->repl_mode = false;
+	vm->quicken = true;
+	vm->use_arenas = false;
+	vm->rand_seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)vm;
+
+	vm->bytes_allocated = 0;
+	vm->next_gc = GC_INITIAL_THRESHOLD;
+	vm->gray_count = 0;
+	vm->gray_capacity = 0;
+	vm->gray_stack = NULL;
+	memset(&vm->gc_stats, 0, sizeof(vm->gc_stats));
+	init_pool(&vm->pool);
+	vm->mappings = NULL;
+	init_arena(&vm->code_arena);
+	init_arena(&vm->data_arena);
+
+	init_table(&vm->strings);
+	init_table(&vm->global_names);
+	vm->globals = NULL;
+	vm->global_count = 0;
+	vm->global_capacity = 0;
+
+	vm->max_frames = FRAMES_MAX;
+	vm->frame_capacity = FRAMES_INITIAL;
+	vm->frames = malloc(sizeof(struct call_frame) * vm->frame_capacity);
+	vm->stack_capacity = STACK_INITIAL;
+	vm->stack = malloc(sizeof(value_t) * vm->stack_capacity);
+	if (!vm->frames || !vm->stack) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
 	reset_stack();
-	define_native("clock", clock_native, 0);
-	define_native("random", rand_native, 0);
-	define_native("input", input_native, 1);
-	define_native("toNumber", str_to_number_native, 1);
+
+	init_output(&vm->out, stdout);
+	vm->err = stderr;
+	init_value_array(&vm->handles);
+	define_natives();
 }
 
 void free_vm()
 {
-	free_table(&vm.globals);
+	free_output(&vm->out);
+	free_value_array(&vm->handles);
+	free_table(&vm->global_names);
+	FREE_ARRAY(struct global, vm->globals, vm->global_capacity);
+	vm->globals = NULL;
+	vm->global_count = 0;
+	vm->global_capacity = 0;
 	free_objects();
-	free_table(&vm.strings);
+	free_table(&vm->strings);
+	unmap_files();
+	free_arena(&vm->code_arena);
+	free_arena(&vm->data_arena);
+
+	free(vm->frames);
+	free(vm->stack);
+	vm->frames = NULL;
+	vm->stack = NULL;
+	vm->frame_capacity = 0;
+	vm->stack_capacity = 0;
+	vm->stack_top = NULL;
+	vm->frame_count = 0;
+	/* last, everything allocated through reallocate is gone*/
+	free_pool(&vm->pool);
+
+#ifdef DEBUG_PROFILE_OPCODES
+	print_opcode_profile();
+#endif
 }
 
 interpret_result_t interpret_vm(const char *src)
@@ -452,27 +1029,197 @@ interpret_result_t interpret_vm(const char *src)
 	if (!function)
 		return INTERPRET_COMPILE_ERROR;
 
+	return interpret_function(function);
+}
+
+/* call the function on the stack below its argc arguments and run it to
+ * completion. The result replaces them on the stack*/
+static interpret_result_t run_call(int argc)
+{
+	int base = vm->frame_count;
+	if (!call_value(vm->stack_top[-1 - argc], argc))
+		return INTERPRET_RUNTIME_ERROR;
+	/* natives are done already*/
+	if (vm->frame_count == base)
+		return INTERPRET_OK;
+	return run_vm(base);
+}
+
+interpret_result_t interpret_function(obj_function_t *function)
+{
 	reset_stack(); /* prevent stack from needlessly growing in repl mode*/
 	push(OBJ(function));
 
-	/* set up first call frame*/
-	call_value(OBJ(function), 0);
-
-	interpret_result_t r = run_vm();
+	interpret_result_t r = run_call(0);
+	if (r == INTERPRET_OK)
+		pop();
 
 	return r;
 }
 
 void push(value_t val)
 {
-	assert(1 + (int)(vm.stack_top - vm.stack) <= STACK_MAX);
-	*vm.stack_top = val;
-	vm.stack_top++;
+	/* every call reserves the room its function needs, so this only grows
+	 * the stack for values pushed outside run_vm: by the compiler, the
+	 * cache loader or the host*/
+	if (vm->stack_top == vm->stack + vm->stack_capacity)
+		grow_stack(vm->stack_capacity * 2);
+	*vm->stack_top = val;
+	vm->stack_top++;
 }
 
 value_t pop()
 {
-	assert(vm.stack_top - vm.stack >= 0);
-	vm.stack_top--;
-	return *vm.stack_top;
+	assert(vm->stack_top - vm->stack >= 0);
+	vm->stack_top--;
+	return *vm->stack_top;
+}
+
+struct vm *vm_new()
+{
+	struct vm *v = malloc(sizeof(struct vm));
+	if (!v) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(74);
+	}
+
+	struct vm *prev = vm;
+	vm = v;
+	init_vm();
+	vm = prev;
+	return v;
+}
+
+void vm_free(struct vm *v)
+{
+	struct vm *prev = vm;
+	vm = v;
+	free_vm();
+	vm = prev == v ? NULL : prev;
+	free(v);
+}
+
+void vm_reset(struct vm *v)
+{
+	struct vm *prev = vm;
+	vm = v;
+
+	reset_stack();
+	for (int i = 0; i < vm->global_count; i++) {
+		vm->globals[i].value = NIL_VAL;
+		vm->globals[i].defined = false;
+	}
+	define_natives();
+	free_value_array(&vm->handles);
+
+	/* nothing can point into the mappings or arenas once the objects
+	 * are gone*/
+	collect_garbage();
+	unmap_files();
+	free_arena(&vm->code_arena);
+	free_arena(&vm->data_arena);
+
+	vm = prev;
+}
+
+interpret_result_t vm_interpret(struct vm *v, const char *src)
+{
+	struct vm *prev = vm;
+	vm = v;
+	interpret_result_t r = interpret_vm(src);
+	vm = prev;
+	return r;
+}
+
+obj_function_t *vm_compile(struct vm *v, const char *src)
+{
+	struct vm *prev = vm;
+	vm = v;
+
+	obj_function_t *script = compile(src);
+	if (script) {
+		push(OBJ(script));
+		write_value_array(&vm->handles, OBJ(script));
+		pop();
+	}
+
+	vm = prev;
+	return script;
+}
+
+interpret_result_t vm_run(struct vm *v, obj_function_t *script)
+{
+	struct vm *prev = vm;
+	vm = v;
+
+	interpret_result_t r = INTERPRET_RUNTIME_ERROR;
+	if (reserve_stack(vm->stack_top - vm->stack + 1)) {
+		push(OBJ(script));
+		r = run_call(0);
+		if (r == INTERPRET_OK)
+			pop();
+	}
+
+	vm = prev;
+	return r;
+}
+
+int vm_global_slot(struct vm *v, const char *name)
+{
+	struct vm *prev = vm;
+	vm = v;
+	int slot = global_slot(copy_string((char *)name, (int)strlen(name)));
+	vm = prev;
+	return slot;
+}
+
+bool vm_push(struct vm *v, value_t value)
+{
+	struct vm *prev = vm;
+	vm = v;
+
+	bool ok = reserve_stack(vm->stack_top - vm->stack + 1);
+	if (ok)
+		push(value);
+
+	vm = prev;
+	return ok;
+}
+
+bool vm_push_global(struct vm *v, int slot)
+{
+	return vm_push(v, v->globals[slot].value);
+}
+
+bool vm_push_string(struct vm *v, const char *chars, int length)
+{
+	struct vm *prev = vm;
+	vm = v;
+
+	/* room for the string, and for allocate_string's own push*/
+	bool ok = reserve_stack(vm->stack_top - vm->stack + 2);
+	if (ok)
+		push(OBJ(copy_string((char *)chars, length)));
+
+	vm = prev;
+	return ok;
+}
+
+interpret_result_t vm_call(struct vm *v, int argc, value_t *result)
+{
+	struct vm *prev = vm;
+	vm = v;
+
+	interpret_result_t r = run_call(argc);
+
+	if (r == INTERPRET_OK) {
+		/* hosts only ever see flat strings*/
+		if (IS_ROPE(vm->stack_top[-1]))
+			vm->stack_top[-1] =
+				OBJ(flatten_rope(AS_ROPE(vm->stack_top[-1])));
+		*result = pop();
+	}
+
+	vm = prev;
+	return r;
 }
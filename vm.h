@@ -5,9 +5,20 @@
 #include "object.h"
 #include "value.h"
 #include "table.h"
+#include "memory.h"
+#include "cache.h"
+#include "output.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (UINT8_MAX * FRAMES_MAX)
+/* both stacks start small and double on demand. Every call reserves the
+ * callee's max_stack values plus STACK_SPARE for objects the runtime keeps
+ * reachable while allocating. Calls nested deeper than vm->max_frames,
+ * FRAMES_MAX unless configured, or needing more than FRAME_SLOTS values per
+ * frame on average, overflow the stack*/
+#define FRAMES_INITIAL 8
+#define STACK_INITIAL 512
+#define STACK_SPARE 4
+#define FRAME_SLOTS 256
+#define FRAMES_MAX 65536
 
 struct call_frame {
 	obj_function_t *function;
@@ -15,15 +26,46 @@ struct call_frame {
 	value_t *slots;
 };
 
+/* global variable slot. The compiler resolves every global name to an index
+ * into vm->globals, so the vm never hashes a name at runtime*/
+struct global {
+	value_t value;
+	obj_string_t *name; /* for error messages */
+	bool defined; /* false until the defining statement has run */
+};
+
 struct vm {
-	struct call_frame frames[FRAMES_MAX];
+	struct call_frame *frames;
 	int frame_count;
-	value_t stack[STACK_MAX]; /* the virtual machine's stack*/
+	int frame_capacity;
+	int max_frames; /* call depth limit, also bounds the value stack */
+	value_t *stack; /* the virtual machine's stack*/
 	value_t *stack_top; /* the top of the vm's stack */
+	int stack_capacity;
 	struct obj *objects; /* head of list of objects to be tracked by vm*/
 	struct table strings; /* hash table of interned strings */
-	struct table globals; /* hash table for global variables */
+	struct table global_names; /* global name -> index into globals */
+	struct global *globals; /* global variables, indexed by slot */
+	int global_count;
+	int global_capacity;
 	bool repl_mode;
+	bool quicken; /* specialize instructions as they run */
+	bool use_arenas; /* finalize compiled chunks, see struct arena */
+	unsigned int rand_seed; /* state of random() */
+	struct output out; /* where print writes, buffered */
+	FILE *err; /* compile and runtime errors */
+	struct value_array handles; /* scripts compiled for the host */
+
+	size_t bytes_allocated; /* bytes currently allocated through reallocate*/
+	size_t next_gc; /* heap size that triggers the next collection */
+	int gray_count;
+	int gray_capacity;
+	struct obj **gray_stack; /* marked objects yet to be traced */
+	struct gc_stats gc_stats;
+	struct pool pool; /* small allocations, see reallocate */
+	struct mapped_file *mappings; /* caches and sources used in place */
+	struct arena code_arena; /* code of finalized chunks */
+	struct arena data_arena; /* their constants and line tables */
 };
 
 typedef enum {
@@ -33,12 +75,68 @@ typedef enum {
 
 } interpret_result_t;
 
-extern struct vm vm;
+/* the vm the calling thread is running. Everything below, and the
+ * compiler, allocator and collector, work on it*/
+extern _Thread_local struct vm *vm;
 void init_vm();
 void free_vm();
 interpret_result_t interpret_vm(const char *c);
+/* run an already compiled top-level script*/
+interpret_result_t interpret_function(obj_function_t *function);
+/* return the slot of the global called name, creating an undefined one if
+ * the name has not been seen before*/
+int global_slot(obj_string_t *name);
 
 void push(value_t val);
 value_t pop();
 
+/* independent interpreters, each with its own heap, strings and globals.
+ * Different threads may run different vms at the same time; a vm must only
+ * be used by one thread at a time. These leave the thread's current vm as
+ * it was*/
+struct vm *vm_new();
+void vm_free(struct vm *v);
+interpret_result_t vm_interpret(struct vm *v, const char *src);
+/* forget the globals, objects and handles earlier scripts left behind,
+ * keeping the vm's settings, its interned names and its allocations for
+ * reuse*/
+void vm_reset(struct vm *v);
+
+/* embedding: compile a script once, run it to define its globals, then call
+ * its functions as often as needed:
+ *
+ *	obj_function_t *script = vm_compile(v, src);
+ *	vm_run(v, script);
+ *	int f = vm_global_slot(v, "f");
+ *	...
+ *	vm_push_global(v, f);
+ *	vm_push(v, NUMBER(1));
+ *	vm_call(v, 1, &result);
+ *
+ * The script handle stays valid until vm_reset or vm_free. A global's slot
+ * never changes, so it is looked up once; what it holds is read on each
+ * push. A result is only safe from the collector until the next call into
+ * the vm, unless something else keeps it alive. Errors are reported on the
+ * vm's err stream and clear the stack*/
+obj_function_t *vm_compile(struct vm *v, const char *src);
+interpret_result_t vm_run(struct vm *v, obj_function_t *script);
+int vm_global_slot(struct vm *v, const char *name);
+/* the vm's stack is bounded by max_frames; these fail when it is full*/
+bool vm_push(struct vm *v, value_t value);
+bool vm_push_global(struct vm *v, int slot);
+bool vm_push_string(struct vm *v, const char *chars, int length);
+/* call the function pushed below the argc arguments on top of the stack.
+ * All of them are popped and the function's result stored in result*/
+interpret_result_t vm_call(struct vm *v, int argc, value_t *result);
+
+/* exit status of the clox process for an interpret result*/
+static inline int exit_status(interpret_result_t r)
+{
+	if (r == INTERPRET_COMPILE_ERROR)
+		return 65;
+	if (r == INTERPRET_RUNTIME_ERROR)
+		return 70;
+	return 0;
+}
+
 #endif
\ No newline at end of file